@@ -1,64 +1,258 @@
 #include "adc.h"
 #include "global.h"
+#include "trace.h"
 
 
 // Macros and constants
 
+// Burst-average mode: ADRPT back-to-back conversions are summed in the ADC's own
+// accumulator, and ADFLTR gets the sum shifted right by ADCRS. Sixteen 10-bit
+// conversions shifted by 2 give a 12-bit result (2 extra bits, and a quarter of
+// the noise) with no CPU work between conversions
+#define ADC_BURST_SAMPLES           (16)
+#define ADC_BURST_ADCON2            (0b00101011) // ADCRS = 2, clear accumulator, burst-average mode
+#define ADC_BURST_ADCON3            (0b00000111) // Set ADTIF at the end of every burst
+#define ADC_BURST_MAX               (1023u * ADC_BURST_SAMPLES >> 2)
+
+// Any non-zero state will do; the ADC stirs in its noise from the first conversion on
+#define RANDOM_INITIAL_STATE_HI     (0x35)
+#define RANDOM_INITIAL_STATE_LO     (0xA7)
+
+// Range of the reciprocal table, covering Vcc from about 1800 to 4000 mV
+#define VCC_MV_TABLE_MIN_COUNTS     (65)
+#define VCC_MV_TABLE_MAX_COUNTS     (145)
+
 // Typedefs
 
+typedef struct
+{
+    uint8_t     adcon0;
+    uint8_t     adpch;
+    uint8_t     adacq; // in ADC (FRC) clocks
+    uint8_t     fvrcon; // zero if the FVR isn't needed
+    bool        burst; // burst-average for a 12-bit result
+} adc_request_config_t;
+
 // Variables
 
-static uint8_t mRandomState; // Most recent PRNG state
-static uint8_t mRandomSeed; // Most recently set seed
+// All of these use the FRC as the ADC clock, which keeps running while the core
+// sleeps, and Vdd as the reference. The acquisition times on the FVR channels
+// are long enough for the FVR to settle
+static const adc_request_config_t cRequestConfigs[ADC_REQ__NUM] = 
+{
+    // FVR (1024 mV, buffer 1), results left-justified (the ADC has only about 8 bits ENOB anyway).
+    // Frc as clock source. Earlier, Fosc/2 had been used as the ADC clock source,
+    // but when Vcc is at about 2.50 V +/- 0.05 V, then sometimes (not always, but
+    // often) the ADC conversion will fail to complete, and the system will hang
+    // waiting for ADGO to go low. It's really strange. At 2.6 V or above, everything
+    // is rock-solid, and at 2.4 V or below, everything is also rock-solid, but
+    // there's something weird about being at 2.5 V. This one took A VERY LONG TIME
+    // to figure out, not least because the conversion that hit it was run only when
+    // entropy was needed for the PRNG, which happened only every 12 seconds or so of
+    // continuous uptime. I had seen some odd behavior while running on a very charged
+    // supercap, in which the system would suddenly die and then reboot about 2 seconds
+    // later, but it took putting the system on a bench supply and watching the KEEP_ON
+    // line to realize that it was actually hanging and getting reset by the watchdog.
+    // Changing to the Frc clock source fixes the issue. 
+    [ADC_REQ_VCC] = { 0b00010000, 0b111111, 30, 0b10000001, false },
+    
+    // ANC5, burst-averaged, 30 us acquisition based on the net 13 kOhm impedance
+    [ADC_REQ_SUPERCAP_RELATIVE] = { 0b00010100, 0b010101, 30, 0, true },
+    
+    // RA0 (ANA0), burst-averaged
+    [ADC_REQ_RF] = { 0b00010100, 0b000000, 10, 0, true },
+};
 
-uint16_t gVcc = 0;
+static uint8_t mQueuedRequests; // Bitmask of requests for ADC_run_queue()
+static uint8_t mReadyResults; // Bitmask of results not yet taken
+static uint16_t mResults[ADC_REQ__NUM];
 
-// Implementations
+// PRNG state, kept as two bytes so that every step is byte-wide
+static uint8_t mRandomHi = RANDOM_INITIAL_STATE_HI;
+static uint8_t mRandomLo = RANDOM_INITIAL_STATE_LO;
+
+// Vcc in millivolts, divided by 16, for each count from VCC_MV_TABLE_MIN_COUNTS
+// to VCC_MV_TABLE_MAX_COUNTS: round(262144 / counts / 16)
+static const uint8_t cVccMvDiv16[VCC_MV_TABLE_MAX_COUNTS - VCC_MV_TABLE_MIN_COUNTS + 1] = {
+    252, 248, 245, 241, 237, 234, 231, 228, 224, 221,
+    218, 216, 213, 210, 207, 205, 202, 200, 197, 195,
+    193, 191, 188, 186, 184, 182, 180, 178, 176, 174,
+    172, 171, 169, 167, 165, 164, 162, 161, 159, 158,
+    156, 155, 153, 152, 150, 149, 148, 146, 145, 144,
+    142, 141, 140, 139, 138, 137, 135, 134, 133, 132,
+    131, 130, 129, 128, 127, 126, 125, 124, 123, 122,
+    121, 120, 120, 119, 118, 117, 116, 115, 115, 114,
+    113
+};
 
+// Start out as low as possible (about 1 V) until the first measurement
+uint8_t gVccCounts = UINT8_MAX;
 
-// Read Vcc in tens of mV
-// Takes about 140 us when Fosc=16MHz, almost entirely due to the division for conversion to millivolts
-uint16_t ADC_read_vcc(void)
+// Implementations
+
+// Stir the noisy low bits of a conversion into the PRNG state. Costs a handful of
+// cycles per conversion, and no conversions are made just for the entropy
+static void adc_mix_entropy(uint8_t sample)
 {
-    uint16_t mv = 0;
+    mRandomLo ^= sample;
     
-    // Set ADC clock to internal (FRC), results left-justified (the ADC has only about 8 bits ENOB anyway)
-    ADCON0 = 0b00010000;
+    // Zero is the one state xorshift can't leave
+    if (!(mRandomLo | mRandomHi))
+    {
+        mRandomHi = RANDOM_INITIAL_STATE_HI;
+    }
+}
+
+// Run one conversion (or burst) with the core idled (with IDLEN set, SLEEP stops only the
+// CPU), woken by the ADC interrupt. Interrupts are held off throughout, so the
+// ADC interrupt only wakes the core and anything else (e.g., a timer callback) 
+// is serviced afterward, no more than a few tens of microseconds late
+static void adc_convert(adc_request_t request)
+{
+    const adc_request_config_t* pConfig = &cRequestConfigs[request];
+    bool interruptsEnabled = GIE;
     
-    // Set the measured channel to FVR and reference to Vdd
-    ADPCH = 0b111111;
-    ADREF = 0b00000000;
+    ADCON0 = pConfig->adcon0;
+    ADPCH = pConfig->adpch;
+    ADREF = 0b00000000; // Reference to Vdd
+    ADACQ = pConfig->adacq;
     
-    // Set acquisition time to 10 ADC clocks (10 us)
-    ADACQ = 10;
+    if (pConfig->burst)
+    {
+        ADCON2 = ADC_BURST_ADCON2;
+        ADCON3 = ADC_BURST_ADCON3;
+        ADRPT = ADC_BURST_SAMPLES;
+    }
+    else
+    {
+        ADCON2 = 0b00000000; // Basic mode
+    }
     
-    // Turn on FVR at 1024 mV for the ADC and wait for it to stabilize
-    FVRCON = 0b10000001;
-    while (!FVRRDY);
+    // Rather than spin on FVRRDY, let the FVR settle during the acquisition time
+    FVRCON = pConfig->fvrcon;
     
-    // Turn on ADC
     ADON = 1;
     
-    // Start conversion
-    ADGO = 1;
+    // In burst mode, ADIF is set after every conversion but ADTIF only at the end
+    GIE = 0;
+    ADIF = 0;
+    ADTIF = 0;
+    ADIE = !pConfig->burst;
+    ADTIE = pConfig->burst;
     
-    // Wait for completion
-    while (ADGO);
+    do
+    {
+        TRACE(TRACE_ADC_BEGIN, ADPCH);
+        ADGO = 1;
+        
+        // Other wake-ups just go back to sleep. Note that if some other enabled
+        // interrupt is already flagged, SLEEP returns at once, so this degrades to a spin
+        while (ADGO)
+        {
+            SLEEP();
+        }
+        ADIF = 0;
+        ADTIF = 0;
+        TRACE(TRACE_ADC_END, ADRESH);
+        
+        // Should the FVR have been slow to start, the result is junk, so do it over
+    } while (pConfig->fvrcon && !FVRRDY);
+    
+    ADIE = 0;
+    ADTIE = 0;
+    GIE = interruptsEnabled;
     
-    // Turn off ADC
     ADON = 0;
     
     // Turn off FVR and buffer
     FVRCON = 0b00000000;
     
-    // Convert the value into millivolts. Note that this isn't exactly 
-    // optimal; however, it's done this way to avoid a lengthy 32-bit
-    // divide, instead reducing the problem to a 16-bit divide followed by two left-rotates
-    // This nets roughly 1024*255/ADRESH in something like 60% fewer cycles 
-    // (note that the value 1024 comes from the FVR reference voltage in millivolts)
-    mv = (uint16_t)(65535u/ADRESH*4u); // TODO: should be 65280
+    switch (request)
+    {
+        case ADC_REQ_SUPERCAP_RELATIVE:
+            mResults[request] = ADC_BURST_MAX - ((uint16_t)(ADFLTRH << 8) | ADFLTRL);
+            break;
+        case ADC_REQ_RF:
+            mResults[request] = (uint16_t)(ADFLTRH << 8) | ADFLTRL;
+            break;
+        default:
+            mResults[request] = ADRESH;
+            break;
+    }
+    
+    mReadyResults |= (uint8_t)(1 << request);
+    
+    // Left- or right-justified, ADRESL holds the least significant (and noisiest) bits
+    adc_mix_entropy(ADRESL);
+}
+
+// Queue up a conversion to be run by the next ADC_run_queue()
+void ADC_queue(adc_request_t request)
+{
+    mQueuedRequests |= (uint8_t)(1 << request);
+}
+
+// Run all of the queued conversions back to back. Their results go to the
+// result slots, to be picked up with ADC_take_result() or the ADC_read_*() calls
+void ADC_run_queue(void)
+{
+    for (uint8_t i = 0; i < ADC_REQ__NUM; i++)
+    {
+        if (mQueuedRequests & (1 << i))
+        {
+            adc_convert((adc_request_t)i);
+        }
+    }
+    
+    mQueuedRequests = 0;
+}
+
+// Fetch (and consume) the result of a completed request. Returns false if there isn't one
+bool ADC_take_result(adc_request_t request, uint16_t* pResult)
+{
+    uint8_t mask = (uint8_t)(1 << request);
+    
+    if (!(mReadyResults & mask))
+    {
+        return false;
+    }
+    
+    mReadyResults &= (uint8_t)~mask;
+    *pResult = mResults[request];
+    
+    return true;
+}
+
+// Use the queued result if there is one, or otherwise run the conversion now
+static uint16_t adc_read(adc_request_t request)
+{
+    uint16_t result = 0;
+    
+    if (!ADC_take_result(request, &result))
+    {
+        ADC_queue(request);
+        ADC_run_queue();
+        ADC_take_result(request, &result);
+    }
+    
+    return result;
+}
+
+// Read Vcc in counts (see ADC_MV_TO_VCC_COUNTS)
+// Takes about 40 us, nearly all of it the acquisition and conversion with the core idle
+uint8_t ADC_read_vcc(void)
+{
+    return (uint8_t)adc_read(ADC_REQ_VCC);
+}
+
+// Convert Vcc counts to millivolts (to within 16 mV), for the rare places that
+// really need them. Counts outside the table are clipped to it
+uint16_t ADC_counts_to_mv(uint8_t counts)
+{
+    counts = MAX(counts, VCC_MV_TABLE_MIN_COUNTS);
+    counts = MIN(counts, VCC_MV_TABLE_MAX_COUNTS);
     
-    return mv;
+    return (uint16_t)cVccMvDiv16[counts - VCC_MV_TABLE_MIN_COUNTS] << 4;
 }
 
 // Read the supercap voltage relative to Vdd to ensure that it doesn't go above
@@ -90,146 +284,43 @@ uint16_t ADC_read_vcc(void)
 // than 3300 mV.
 uint8_t ADC_read_supercap_relative(void)
 {
-    uint8_t countsDownFromVdd = 0;
-    
-    // Set ADC clock to internal (FRC), results left-justified 
-    ADCON0 = 0b00010000;
-    
-    // Set the measured channel to ANC5 and reference to Vdd
-    ADPCH = 0b010101;
-    ADREF = 0b00000000;
-    
-    // Set acquisition time to 30 ADC clocks (30 us) (based on the net 13 kOhm impedance)
-    ADACQ = 30;
-        
-    // Turn on ADC
-    ADON = 1;
-    
-    // Start conversion
-    ADGO = 1;
-    
-    // Wait for completion
-    while (ADGO);
-    
-    // Turn off ADC
-    ADON = 0;
-    
-    countsDownFromVdd = UINT8_MAX - ADRESH;
-    
-    return countsDownFromVdd;
+    return (uint8_t)(ADC_read_supercap_relative_x16() >> 4);
 }
 
-
-// Read Vcc in counts, trying for maximum noise
-// Takes about 9 us when Fosc=16MHz
-uint8_t ADC_read_vcc_fast(void)
+// The same, burst-averaged to 12 bits (i.e., in sixteenths of a count)
+// Takes about 1.3 ms, with the core idle
+uint16_t ADC_read_supercap_relative_x16(void)
 {
-    // Frc as clock source. Earlier, Fosc/2 had been used as the ADC clock source,
-    // but when Vcc is at about 2.50 V +/- 0.05 V, then sometimes (not always, but
-    // often) the ADC conversion will fail to complete, and the system will hang
-    // waiting for ADGO to go low. It's really strange. At 2.6 V or above, everything
-    // is rock-solid, and at 2.4 V or below, everything is also rock-solid, but
-    // there's something weird about being at 2.5 V. This one took A VERY LONG TIME
-    // to figure out, not least because this function is called only when entropy
-    // is needed for the PRNG, which happens only every 12 seconds or so of
-    // continuous uptime. I had seen some odd behavior while running on a very charged
-    // supercap, in which the system would suddenly die and then reboot about 2 seconds
-    // later, but it took putting the system on a bench supply and watching the KEEP_ON
-    // line to realize that it was actually hanging and getting reset by the watchdog.
-    // Changing to the Frc clock source fixes the issue. 
-    ADCON0 = 0b10010100; 
-    
-    // Set the measured channel to FVR and reference to Vdd
-    ADPCH = 0b111111;
-    ADREF = 0b00000000;
-    
-    // Set acquisition time to almost nothing
-    ADACQ = 10;
-    
-    // Turn on FVR at 1024 mV for the ADC and wait for it to stabilize
-    FVRCON = 0b10000001;
-    while (!FVRRDY);
-
-    // Turn on ADC
-    ADON = 1;
-    
-    // Start conversion
-    ADGO = 1;
-    
-    // Wait for completion
-    while (ADGO);
-    
-    // Turn off ADC
-    ADON = 0;
-    
-    // Turn off FVR and buffer
-    FVRCON = 0b00000000;
-            
-    return ADRESL ^ ADRESH;
+    return adc_read(ADC_REQ_SUPERCAP_RELATIVE);
 }
 
-// Read the RF level for setting the comms slicer
-// Takes about 120 us
+// Read the RF level for setting the comms slicer, burst-averaged and rounded to 8 bits
+// Takes about 700 us, with the core idle
 uint8_t ADC_read_rf(void)
 {
-    // Set ADC clock to internal (FRC), results left-justified
-    ADCON0 = 0b00010000;
-    
-    // Set the measured channel to RA0 (ANA0) and reference to Vdd
-    ADPCH = 0b000000;
-    ADREF = 0b00000000;
-    
-    // Set acquisition time to 10 ADC clocks (10 us)
-    ADACQ = 10;
-        
-    // Turn on ADC
-    ADON = 1;
-    
-    // Start conversion
-    ADGO = 1;
-    
-    // Wait for completion
-    while (ADGO);
-    
-    // Turn off ADC
-    ADON = 0;
+    uint16_t level = (adc_read(ADC_REQ_RF) + 8) >> 4;
     
-    return (uint8_t)(ADRESH);    
+    return (uint8_t)MIN(level, UINT8_MAX);
 }
 
 
-// Linear feedback shift register random number generator. Has a period of 127.
+// 16-bit xorshift random number generator (shifts 7, 9, 8), with a period of 65535
+// and none of the long runs in the low bits that the old 7-bit LFSR had. The
+// state is worked on a byte at a time, since this platform shifts only one bit
+// per instruction: x ^= x << 8 and x ^= x >> 9 are single byte XORs, and x ^= x << 7
+// is a one-bit right shift across the bytes. About 20 instructions per call
 uint8_t ADC_random_int(void)
-{    
-    // Generate feedback by XORing bits at specific taps
-    // This next line is equivalent to feedback = ((mRandomState >> 6) ^ (mRandomState >> 5)) & 1;
-    // except that it reduces the number of shifts, which must be done one at a time
-    // on this platform in loops (we save at least 24 machine cycles this way)
-    uint8_t feedback = !!(((mRandomState >> 1) ^ mRandomState) & 0b00100000);
-
-    // Shift the register and insert feedback at the lowest bit
-    mRandomState = (uint8_t)(mRandomState << 1) | feedback;
-
-    return mRandomState;
-}
-
-void ADC_set_random_seed(uint8_t seed)
-{
-    // Ensure it's non-zero and not the degenerate case (seed == 128)
-    if (seed == 0 || seed == 128)
-    {
-        mRandomSeed = 0x35;
-    }
-    else
-    {
-        mRandomSeed = seed;    
-    }
-
-    mRandomState = mRandomSeed;    
-}
-
-// Return the most recent random number
-uint8_t ADC_get_random_state(void)
 {
-    return mRandomState;
+    // x ^= x << 7
+    uint8_t carry = (uint8_t)(mRandomLo << 7);
+    mRandomHi ^= (uint8_t)(mRandomHi << 7) | (mRandomLo >> 1);
+    mRandomLo ^= carry;
+    
+    // x ^= x >> 9
+    mRandomLo ^= mRandomHi >> 1;
+    
+    // x ^= x << 8
+    mRandomHi ^= mRandomLo;
+    
+    return mRandomLo;
 }
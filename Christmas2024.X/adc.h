@@ -3,14 +3,41 @@
 
 #include "global.h"
 
-extern uint16_t gVcc;
+// Cycle cost and deadline of ADC_read_vcc(), used to pick the clock speed for it.
+// While charging, Vcc is read every tick to stop charging before a brownout, so 
+// the result needs to be in hand promptly
+#define ADC_READ_VCC_CYCLES         (120) // about 30 us at 16 MHz; the conversion itself runs with the core idle
+#define ADC_READ_VCC_DEADLINE_US    (600)
 
-uint16_t ADC_read_vcc(void);
+// Vcc is kept as the raw ratio of the 1024 mV FVR to Vdd (the upper 8 bits of the
+// 10-bit result), so it falls as Vcc rises: counts = 1024 * 256 / mV. Thresholds 
+// in millivolts are converted to counts at compile time, so that comparisons 
+// need no arithmetic at run time. Note that a count is about 40 mV at 3.3 V
+#define ADC_VCC_COUNTS_NUMERATOR    (262144UL)
+#define ADC_MV_TO_VCC_COUNTS(_mv)   ((uint8_t)((ADC_VCC_COUNTS_NUMERATOR + (_mv) / 2) / (_mv)))
+
+#define VCC_ABOVE_MV(_mv)           (gVccCounts < ADC_MV_TO_VCC_COUNTS(_mv))
+#define VCC_BELOW_MV(_mv)           (gVccCounts > ADC_MV_TO_VCC_COUNTS(_mv))
+
+// Conversions that can be queued up and run back to back with ADC_run_queue()
+typedef enum
+{
+    ADC_REQ_VCC,                // FVR against Vdd
+    ADC_REQ_SUPERCAP_RELATIVE,  // ANC5 (supercap monitor)
+    ADC_REQ_RF,                 // ANA0 (RF level)
+    ADC_REQ__NUM
+} adc_request_t;
+
+extern uint8_t gVccCounts;
+
+void ADC_queue(adc_request_t request);
+void ADC_run_queue(void);
+bool ADC_take_result(adc_request_t request, uint16_t* pResult);
+uint8_t ADC_read_vcc(void);
+uint16_t ADC_counts_to_mv(uint8_t counts);
 uint8_t ADC_random_int(void);
-void ADC_set_random_seed(uint8_t seed);
-uint8_t ADC_get_random_state(void);
 uint8_t ADC_read_rf(void);
-uint8_t ADC_read_vcc_fast(void);
 uint8_t ADC_read_supercap_relative(void);
+uint16_t ADC_read_supercap_relative_x16(void);
         
 #endif
@@ -0,0 +1,140 @@
+#include "anim.h"
+#include "global.h"
+#include "nvm.h"
+#include "adc.h"
+#include "leds.h"
+
+// Macros and constants
+
+#define ANIM_OP_MASK                (0b111 << 5)
+#define ANIM_ARG_MASK               (0b00011111)
+
+// LED operand: brightness level above the on-time
+#define ANIM_LED_TIME_MASK          (0b00111111)
+#define ANIM_LED_LEVEL_SHIFT        (6)
+
+// Typedefs
+
+// Variables
+
+// The program, read from EEPROM once so that running it never waits on the NVM
+static uint8_t mProgram[ANIM_PROGRAM_LEN];
+
+static bool mRunning = false;
+static uint8_t mPc = 0;
+static uint8_t mWaitTicks = 0;
+static uint8_t mLoopCount = 0;
+
+// Implementations
+
+// The next byte of the program. Running off the end reads as an invalid opcode
+static uint8_t anim_fetch(void)
+{
+    if (mPc >= ANIM_PROGRAM_LEN)
+    {
+        return UINT8_MAX;
+    }
+    
+    return mProgram[mPc++];
+}
+
+// Look for a program in EEPROM, and load it
+void ANIM_init(void)
+{
+    uint8_t i;
+    
+    mRunning = (NVM_read_eeprom(NVM_EEPROM_ANIM_ADDR) == ANIM_MAGIC);
+    
+    for (i = 0; mRunning && i < ANIM_PROGRAM_LEN; i++)
+    {
+        mProgram[i] = NVM_read_eeprom(ANIM_PROGRAM_ADDR + i);
+    }
+    
+    mPc = 0;
+    mWaitTicks = 0;
+    mLoopCount = 0;
+}
+
+// True if there's a program, and it hasn't stopped
+bool ANIM_running(void)
+{
+    return mRunning;
+}
+
+// A tick on which the program couldn't run (the LEDs were still busy) still
+// counts toward a WAIT
+void ANIM_step_skipped(void)
+{
+    if (mWaitTicks)
+    {
+        mWaitTicks--;
+    }
+}
+
+// Run the program for one tick: until it waits, ends, or uses up its instructions
+// for the tick, whichever comes first
+void ANIM_step(void)
+{
+    uint8_t ops = ANIM_OPS_PER_TICK;
+    
+    if (mWaitTicks)
+    {
+        mWaitTicks--;
+        return;
+    }
+    
+    while (mRunning && ops)
+    {
+        uint8_t op = anim_fetch();
+        uint8_t arg = op & ANIM_ARG_MASK;
+        uint8_t operand = 0;
+        
+        ops--;
+        
+        switch (op & ANIM_OP_MASK)
+        {
+            case ANIM_OP_END:
+                mPc = 0;
+                return;
+            case ANIM_OP_LED:
+                operand = anim_fetch();
+                if (!LED_frame_set_checked(arg | (uint8_t)((operand >> ANIM_LED_LEVEL_SHIFT) << 5), operand & ANIM_LED_TIME_MASK))
+                {
+                    mRunning = false;
+                }
+                break;
+            case ANIM_OP_WAIT:
+                mWaitTicks = arg;
+                return;
+            case ANIM_OP_RAND:
+                operand = anim_fetch();
+                if ((ADC_random_int() & ANIM_ARG_MASK) <= arg)
+                {
+                    mPc = operand;
+                }
+                break;
+            case ANIM_OP_VCC:
+                operand = anim_fetch();
+                // Guard level l is 8 * l ADC counts, and counts fall as Vcc rises
+                if (gVccCounts < (uint8_t)(arg << 3))
+                {
+                    mPc = operand;
+                }
+                break;
+            case ANIM_OP_LOOP:
+                operand = anim_fetch();
+                if (!mLoopCount)
+                {
+                    mLoopCount = arg + 1;
+                }
+                if (--mLoopCount)
+                {
+                    mPc = operand;
+                }
+                break;
+            default:
+                mRunning = false;
+                break;
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef __ANIM_H
+#define __ANIM_H
+
+#include "global.h"
+#include "nvm.h"
+
+// LED animation programs, stored in data EEPROM so that a new animation needs no
+// reflash (see web/led_asm.py). The area holds ANIM_MAGIC and then the program,
+// which ANIM_init() copies into RAM at boot.
+// Each instruction is an opcode (top 3 bits) with a 5-bit argument, and some take
+// an operand byte. Branch targets are offsets into the program:
+//
+//   END              restart from the top on the next tick
+//   LED pin, op      add LED pin (offset from RA0PPS) to the frame, operand is
+//                    level << 6 | on-time in quarter milliseconds (1 to 63).
+//                    A pin that isn't an LED's (like KEEP_ON_PIN) stops the
+//                    program. Harvest LEDs (port C) are always full brightness
+//   WAIT n           end this tick's run and sleep n more ticks (counted whether
+//                    or not the LEDs were free on them)
+//   RAND p, target   branch with a probability of (p + 1) / 32 (31 always branches)
+//   VCC l, target    branch if Vcc is above supply guard level l (VCC_LEVEL_MV())
+//   LOOP n, target   branch n times, then fall through (one loop counter)
+//
+// Any other opcode (like erased EEPROM) stops the program, and the LEDs go back to
+// the built-in twinkles
+#define ANIM_MAGIC                  (0xA5)
+#define ANIM_PROGRAM_ADDR           (NVM_EEPROM_ANIM_ADDR + 1)
+#define ANIM_PROGRAM_LEN            (NVM_EEPROM_ANIM_LEN - 1)
+
+#define ANIM_OP_END                 (0b000 << 5)
+#define ANIM_OP_LED                 (0b001 << 5)
+#define ANIM_OP_WAIT                (0b010 << 5)
+#define ANIM_OP_RAND                (0b011 << 5)
+#define ANIM_OP_VCC                 (0b100 << 5)
+#define ANIM_OP_LOOP                (0b101 << 5)
+
+// The interpreter runs at most this many instructions per tick, and none costs
+// more than ANIM_OP_CYCLES (two fetches from the RAM copy plus a checked add of an
+// LED to a full frame, the most expensive), so no program can run over
+// ANIM_STEP_CYCLES
+#define ANIM_OPS_PER_TICK           (8)
+#define ANIM_OP_CYCLES              (150)
+
+// Cycle cost and deadline of ANIM_step(), used to pick the clock speed for it
+#define ANIM_STEP_CYCLES            (ANIM_OPS_PER_TICK * ANIM_OP_CYCLES)
+#define ANIM_STEP_DEADLINE_US       (600)
+
+void ANIM_init(void);
+bool ANIM_running(void);
+void ANIM_step(void);
+void ANIM_step_skipped(void);
+
+#endif
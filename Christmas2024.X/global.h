@@ -25,6 +25,15 @@
 #define DEBUG_CLEAR()       LATC = (LATC & ~(DEBUG_PIN))
 #define DEBUG_VALUE(_x)     LATC = (LATC & ~(DEBUG_PIN)) | ((!_x - 1) & (DEBUG_PIN))
 
+// Image variants. The factory image (the default) includes the self-test; build
+// with FIELD_IMAGE defined to leave it out of the cards that ship. See
+// web/build_variants.py
+#ifdef FIELD_IMAGE
+#define FEATURE_SELF_TEST   (0)
+#else
+#define FEATURE_SELF_TEST   (1)
+#endif
+
 
 const uint8_t cSetBitsInByte[256] = {
     0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
@@ -48,9 +57,25 @@ const uint8_t cSetBitsInByte[256] = {
 
 typedef void (*func_t)(void);
 
+// Worst-case cost of a TIMER_once() callback in instruction cycles, including the
+// wake from sleep and the interrupt entry and exit. Callbacks must stay within this,
+// as it's used to pick the clock speed while a callback is pending
+#define TIMER_CALLBACK_CYCLES   (60)
+
+// Timer2 free-runs on the LFINTOSC as the PWM timebase for regulated charging 
+// (PWM6) and the LED dimming carrier (CCP1): 32 counts, about 1 ms, for a 7-bit
+// duty cycle. It runs only while at least one of its users needs it
+#define TIMER2_PWM_PR           (31)
+#define TIMER2_PWM_DUTY_MAX     ((TIMER2_PWM_PR + 1) * 4)
+
+#define TIMER2_USER_CHARGER     (1 << 0)
+#define TIMER2_USER_LED_DIMMING (1 << 1)
+
 
 extern uint32_t gTickCount; // absolute tick count
 
 void TIMER_once(func_t pCallback, uint8_t halfMilliseconds);
+uint16_t TIMER_quarter_ms_to_counts(uint8_t quarterMilliseconds);
+void TIMER2_use(uint8_t user, bool inUse);
 
 #endif
@@ -0,0 +1,17 @@
+// Generated by web/gen_led_calibration.py. Edit the measurements, not this file
+#ifndef __LED_CALIBRATION_H
+#define __LED_CALIBRATION_H
+
+#include "global.h"
+
+#define LED_CALIBRATION_PINS        (24)
+
+// On-time scale of each LED pin, by its offset from RA0PPS, in Q7 (128 is 1.0)
+static const uint8_t cLedOnTimeScaleQ7[LED_CALIBRATION_PINS] =
+{
+    128, 128, 128, 128, 128, 128, 128, 128, // port A
+    128, 128, 128, 128, 128, 128, 128, 128, // port B
+    128, 128, 128, 128, 128, 128, 128, 128, // port C
+};
+
+#endif
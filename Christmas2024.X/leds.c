@@ -4,6 +4,9 @@
 #include "rf.h"
 #include "prefs.h"
 #include "self_test.h"
+#include "twinkle_schedule.h"
+#include "led_calibration.h"
+#include "supercap.h"
 
 // Macros and constants
 
@@ -18,16 +21,50 @@
 
 #define LED_BLINK_TIME_LIMIT_HARSH_SITUATIONS   7 // MUST per a power of 2 - 1
 
-#define LED_HARVEST_STOKER_THRESH_LOW_MV        (2300) // Should be above the voltage at which the system will be powerd on LEDs alone
-#define LED_HARVEST_STOKER_TIME_LOW_MS          (18)
-#define LED_HARVEST_STOKER_THRESH_HIGH_MV       (2800) 
-#define LED_HARVEST_STOKER_TIME_HIGH_MS         (25)
+// The stoker adapts over epochs of this many stoke opportunities (one twinkle
+// step in 16, so about 13 s at 10 Hz twinkles), by how much the harvest gained
+// from the start of the epoch to the end. Each measuring epoch is followed by one
+// where the stoker holds its level and the charger's power point tracker gets to
+// move instead (see LED_stoker_measuring()), so the two don't chase each other
+#define LED_STOKER_EPOCH_SLOTS                  (8)
+#define LED_STOKER_EPOCH_MAX_TICKS              (30 * TICKS_PER_SEC) // longer, and stoking has stopped
+#define LED_STOKER_LEVEL_INITIAL                (5)
 
 #define LED_SELF_TEST_LED_TEST_TIME_MS          (25)
 
 #define LED_SELF_TEST_STATUS_TIME_MS            (10)
 
-#define PORT_C_NON_LED_MASK  (0xFC)
+// LED pulses come from PWM7, routed through PPS to one LED pin at a time. The pin
+// is named by its offset from RA0PPS, since the RxyPPS registers are contiguous
+#define LED_PULSE_PPS                   (0x0F) // PWM7OUT
+#define LED_PULSE_PPS_DIMMED            (0x01) // CLC1OUT, PWM7 gated by the CCP1 carrier
+#define LED_PULSE_PPS_LAT               (0x00) // Back to the pin's LAT bit
+#define LED_PIN_INDEX(_port, _pin)      (uint8_t)((_port) * 8 + (_pin))
+
+// Brightness levels, as a right shift of full brightness. A dimmed pulse chops 
+// the LED with the CCP1 carrier (a duty cycle of one over two to the level) off
+// the roughly 1 ms Timer2 period. Timer2, CCP1 and CLC1 are powered only for 
+// frames with a dimmed pulse in them. The built-in twinkles are all at full
+// brightness (see LED_LEVELS in web/gen_twinkle_schedule.py), so for now only
+// animation programs (see anim.h) dim an LED
+#define LED_LEVEL_FULL                  (0)
+
+// CLC data input selections (CLCxSELy) for the LED dimming gate
+#define CLC_IN_CCP1                     (0x15)
+#define CLC_IN_PWM7                     (0x1B)
+
+// A dimmed pulse with at least this much light (in quarter milliseconds at full
+// brightness, one carrier period) is sent as a shorter full-brightness one instead
+#define LED_BRIGHT_PULSE_MIN            (4)
+
+// The frame buffer holds the LEDs to light on this tick, each with its level and
+// on-time. The scan lights them one after another, a hardware pulse each, chained
+// from the Timer4 interrupt at the end of each pulse, so they appear together. The
+// on-time of a whole frame is held to the longest single blink (half as long at
+// low Vcc), so more LEDs in a frame means shorter blinks, not more current
+#define LED_FRAME_SLOTS                 (4)
+#define LED_FRAME_BUDGET                (32) // quarter milliseconds
+#define LED_FRAME_BUDGET_LOW            (LED_FRAME_BUDGET / 2)
 
 // Typedefs
 
@@ -45,26 +82,47 @@ typedef struct
     uint8_t     pin;
 } led_blink_prog_step_t;
 
-static const led_blink_prog_step_t cLedTwinkle[LED_CYCLE_LENGTH] =
+typedef struct
 {
-    {LED_PORT_B, 1},
-    {LED_PORT_B, 4}, // tree star
-    {LED_PORT_A, 2},
-    {LED_IDLE, 0},
-    {LED_PORT_B, 0},
-    {LED_PORT_A, 4},
-    {LED_PORT_C, 0},
-    {LED_PORT_B, 5},
-    {LED_PORT_B, 3},
-    {LED_PORT_A, 5},
-    {LED_PORT_B, 4}, // tree star
-    {LED_PORT_B, 2},
-    {LED_PORT_A, 7},
-    {LED_PORT_C, 1},
-    {LED_PORT_C, 3}, // "stoke" the harvest LED rail
-    {LED_PORT_B, 4}, // tree star
+    uint8_t     pin; // offset from RA0PPS and level, as in cTwinklePins
+    uint8_t     quarterMs;
+    
+    // The pulse, worked out by led_pulse_prepare()
+    uint8_t     counts; // Timer4 counts
+    uint8_t     pps; // PWM7 or CLC1
+    uint8_t     duty; // CCP1 carrier duty cycle, for dimmed pulses
+} led_frame_slot_t;
+
+typedef struct
+{
+    uint8_t     timeMs; // zero for no stoking at all
+    uint8_t     skip; // opportunities to pass up between stokes
+} led_stoker_level_t;
+
+// Stoker settings in increasing order of charge spent per opportunity. The stoker
+// climbs or descends this table a step per epoch, whichever way nets more Vcc
+static const led_stoker_level_t cStokerLevels[] =
+{
+    {0, 0},
+    {6, 3},
+    {12, 3},
+    {12, 1},
+    {18, 1},
+    {18, 0}, // the old fixed setting at low Vcc
+    {25, 0}, // the old fixed setting at high Vcc
+    {32, 0},
+};
+
+// The LED pins of each port: the RF and tree LEDs on ports A and B, and the
+// harvest LEDs on port C. Keep web/led_asm.py in sync
+static const uint8_t cLedPinMasks[LED_IDLE] =
+{
+    0b10111110, // RA1-RA5, RA7
+    0b00111111, // RB0-RB5
+    0b00000011, // RC0, RC1
 };
 
+#if FEATURE_SELF_TEST
 static const led_blink_prog_step_t cLedSelfTest[LED_CYCLE_LENGTH] = 
 {
     {LED_PORT_C, 3}, // "stoke" the harvest LED rail
@@ -84,35 +142,213 @@ static const led_blink_prog_step_t cLedSelfTest[LED_CYCLE_LENGTH] =
     {LED_IDLE, 0}, // RF activity LED is tested as part of the self-test state machine
     {LED_IDLE, 0}, // RF ACK LED is tested as part of the self-test state machine
 };
+#endif
 
 // Variables
 
 static uint8_t mLedCounter = 0;
 
+// The pin (offset from RA0PPS) that PWM7 (or CLC1) was last routed to
+static uint8_t mPulsePinIndex = LED_PIN_INDEX(LED_PORT_A, RF_LVL_LED_PIN);
+
+static led_frame_slot_t mFrame[LED_FRAME_SLOTS];
+static uint8_t mFrameCount = 0;
+static uint8_t mFrameNext = 0;
+static volatile bool mFrameScanning = false;
+static bool mDimmingPowered = false;
+
+// The twinkle schedule (see twinkle_schedule.h) for the current preferences
+static const uint8_t* mpTwinkleActions = cTwinkleActions[0];
+
+static uint8_t mStokerLevel = LED_STOKER_LEVEL_INITIAL;
+static int8_t mStokerDirection = -1;
+static uint8_t mStokerSlots = 0; // opportunities so far in this epoch and the held one after it
+static uint32_t mStokerEpochStartTick = 0;
+static uint8_t mStokerSkipped = 0;
+static uint8_t mStokerEpochStartCounts = 0;
+static uint8_t mStokerEpochStartDuty = 0;
+static int16_t mStokerLastGain = 0;
+
 // Implementations
 
 
-// Turn off all port B LEDs. INTERRUPT CALLBACK USE ONLY.
-static void turnOffAllPortBLeds(void)
+// Power the LED dimming hardware (the Timer2 timebase, the CCP1 carrier, and the
+// CLC1 gate) up or down. Powering a module up through PMD resets it, so it's set
+// up afresh each time
+static void led_dimming_power(bool on)
+{
+    if (on == mDimmingPowered)
+    {
+        return;
+    }
+    
+    mDimmingPowered = on;
+    
+    if (on)
+    {
+        TIMER2_use(TIMER2_USER_LED_DIMMING, true);
+        PMD3bits.CCP1MD = 0;
+        PMD5bits.CLC1MD = 0;
+        
+        // CCP1 -- LED dimming carrier, duty cycle set per pulse
+        CCPTMRS0bits.C1TSEL = 0b01; // CCP1 off Timer2
+        CCPR1H = 0;
+        CCPR1L = 0;
+        CCP1CON = 0b10011111; // Enabled, left-aligned duty cycle, PWM mode
+        
+        // CLC1 -- PWM7 AND the CCP1 carrier
+        CLC1SEL0 = CLC_IN_PWM7;
+        CLC1SEL1 = CLC_IN_CCP1;
+        CLC1GLS0 = 0b00000010; // Gate 1 = data 1 (PWM7)
+        CLC1GLS1 = 0b00001000; // Gate 2 = data 2 (CCP1)
+        CLC1GLS2 = 0b00000000; // Gates 3 and 4 have no inputs, so are low...
+        CLC1GLS3 = 0b00000000;
+        CLC1POL = 0b00001100; // ...and inverted to high
+        CLC1CON = 0b10000010; // Enabled, 4-input AND
+    }
+    else
+    {
+        CLC1CON = 0b00000000;
+        CCP1CON = 0b00000000;
+        PMD5bits.CLC1MD = 1;
+        PMD3bits.CCP1MD = 1;
+        TIMER2_use(TIMER2_USER_LED_DIMMING, false);
+    }
+}
+
+// Work out the pulse for one LED of the frame, ahead of the scan. The pulse 
+// lasts the slot's time (in quarter milliseconds) at the slot's brightness level.
+//
+// A flash this short is seen by the light it puts out, brightness times time, 
+// and a pin drives its LED at the same current whether or not it's chopped. So a
+// dimmed pulse costs just as much charge per unit of light as a shortened one, 
+// and dimming is only used for less light than a full-brightness pulse can 
+// resolve. The carrier free-runs, so the light of a dimmed pulse shorter than a
+// carrier period varies, but it's right on average
+static void led_pulse_prepare(led_frame_slot_t* pSlot)
+{
+    uint8_t level = TWINKLE_PIN_LEVEL(pSlot->pin);
+    uint8_t quarterMilliseconds = pSlot->quarterMs;
+    uint8_t light = quarterMilliseconds >> level;
+    
+    pSlot->pps = LED_PULSE_PPS;
+    pSlot->duty = 0;
+    
+    if (level != LED_LEVEL_FULL && light < LED_BRIGHT_PULSE_MIN)
+    {
+        // The upper 8 of the 10 duty cycle bits, for CCPR1H
+        pSlot->duty = (uint8_t)((TIMER2_PWM_DUTY_MAX >> level) >> 2);
+        pSlot->pps = LED_PULSE_PPS_DIMMED;
+    }
+    else
+    {
+        quarterMilliseconds = light;
+    }
+    
+    pSlot->counts = (uint8_t)MIN(TIMER_quarter_ms_to_counts(quarterMilliseconds), UINT8_MAX);
+}
+
+// Light one LED of the frame. Timer4, in one-shot mode, is the timebase for PWM7,
+// whose duty cycle covers all but the last count of the period; the pin goes low
+// at the duty cycle match and Timer4 stops itself at the period match, so the
+// pulse ends with no clock change and the core asleep. The pin stays on PWM7 (or
+// CLC1) low until the next pulse moves it. Note that port C pins stay connected
+// to their output drivers afterward, since the very act of pulling the pin low
+// (via the driver) is what causes the "high-side" harvest LEDs to blink
+static void led_pulse_start(const led_frame_slot_t* pSlot)
+{
+    uint8_t pinIndex = TWINKLE_PIN_INDEX(pSlot->pin);
+    
+    (&RA0PPS)[mPulsePinIndex] = LED_PULSE_PPS_LAT;
+    
+    CCPR1H = pSlot->duty;
+    T4PR = pSlot->counts;
+    TMR4 = 0;
+    PWM7DCH = pSlot->counts;
+    PWM7DCL = 0;
+    
+    (&RA0PPS)[pinIndex] = pSlot->pps;
+    mPulsePinIndex = pinIndex;
+    
+    T4CONbits.ON = 1;
+}
+
+// Add an LED to the next frame, or lengthen its blink if it's already there. Once
+// the frame is full, or while the last one is still being shown, further LEDs are
+// dropped. The pin entry is as in cTwinklePins, so a plain pin index is full level
+void LED_frame_set(uint8_t pinEntry, uint8_t quarterMilliseconds)
 {
-    PORTB = 0;
+    uint8_t i;
+    
+    if (mFrameScanning)
+    {
+        return;
+    }
+    
+    for (i = 0; i < mFrameCount; i++)
+    {
+        if (mFrame[i].pin == pinEntry)
+        {
+            mFrame[i].quarterMs = MAX(mFrame[i].quarterMs, quarterMilliseconds);
+            return;
+        }
+    }
+    
+    if (mFrameCount < LED_FRAME_SLOTS)
+    {
+        mFrame[mFrameCount].pin = pinEntry;
+        mFrame[mFrameCount].quarterMs = quarterMilliseconds;
+        mFrameCount++;
+    }
 }
 
-// Turn off all port B LEDs. INTERRUPT CALLBACK USE ONLY.
-static void turnOffAllPortALeds(void)
+// Add an LED from outside the firmware (an animation program) to the next frame,
+// as LED_frame_set() does, but only if its pin is really an LED's. Any other pin
+// could be KEEP_ON_PIN, the charger's PWM output, or the RF input. Returns false
+// if the pin isn't an LED's
+bool LED_frame_set_checked(uint8_t pinEntry, uint8_t quarterMilliseconds)
 {
-    PORTA = 0;
+    uint8_t pinIndex = TWINKLE_PIN_INDEX(pinEntry);
+    uint8_t port = pinIndex >> 3;
+    uint8_t mask = (uint8_t)(1 << (pinIndex & 0x07));
+    
+    if (port >= LED_IDLE || !(cLedPinMasks[port] & mask))
+    {
+        return false;
+    }
+    
+    if (port == LED_PORT_C)
+    {
+        // Connect the harvest LED's output driver, as LED_twinkle() does. The 
+        // harvest LEDs light while the pin is low, so they can't be dimmed
+        TRISC &= (uint8_t)~mask;
+        pinEntry = pinIndex;
+    }
+    
+    LED_frame_set(pinEntry, quarterMilliseconds);
+    return true;
 }
 
-// Turn off all port C LEDs. INTERRUPT CALLBACK USE ONLY.
-static void turnOffAllPortCLeds(void)
+// Light the next LED of the frame. Runs in the Timer4 interrupt, so everything is
+// worked out ahead of time. The last pulse of the frame (the only one, usually)
+// ends on its own like any other, so the frame is finished as soon as it starts
+// and the interrupt is left off
+static void led_frame_next(void)
 {
-    // Don't disconnect the output drivers, since the very act of
-    // pulling the pin low (via the driver) is what causes the "high-side"
-    // harveset LEDs to blink
-//    TRISC |= (LED_BACKDRIVE_PIN_1 | LED_BACKDRIVE_PIN_2);
+    led_pulse_start(&mFrame[mFrameNext]);
+    mFrameNext++;
+    TMR4IF = 0;
     
-    LATC = LATC & PORT_C_NON_LED_MASK; // don't spoil the non-LED pins on port C
+    if (mFrameNext < mFrameCount)
+    {
+        TMR4IE = 1;
+    }
+    else
+    {
+        TMR4IE = 0;
+        mFrameCount = 0;
+        mFrameScanning = false;
+    }
 }
 
 // Turn off the "soft" harvest LED stoker
@@ -122,81 +358,120 @@ static void turnOffHarvestStoker(void)
 }
 
 
-// Twinkle the tree LEDs
-void LED_twinkle(void)
-{   
-    uint8_t randomInt = ADC_random_int();
-    uint8_t remainder = ((randomInt + mLedCounter) % LED_CYCLE_LENGTH);
-         
-    // Limit power at startup no matter what the preferences say
-    uint8_t timeLimit = gPrefsCache.blinkTimeLimit;
-    timeLimit = (gTickCount < (2*TICKS_PER_SEC)) ? MIN(timeLimit, LED_BLINK_TIME_LIMIT_HARSH_SITUATIONS) : timeLimit;
+// At the end of an epoch, step the stoker level whichever way looks better: keep 
+// going if the harvest gained more than over the last epoch, or turn around if
+// not. If it lost, stoking is just burning charge, so back off regardless. The
+// gain is the rise in Vcc plus the rise in the charger's duty cycle: while 
+// charging is regulated, Vcc is held at the setpoint and extra harvest shows up
+// as charge current instead
+static void led_adapt_stoker(void)
+{
+    // Counts fall as Vcc rises
+    int16_t gain = (int16_t)mStokerEpochStartCounts - (int16_t)gVccCounts;
+    gain += (int16_t)SUPERCAP_get_charge_duty() - (int16_t)mStokerEpochStartDuty;
+    int8_t next = 0;
     
-    // Also limit power if VCC is low
-    timeLimit = (gVcc < LED_BLINK_LOW_THRESH_MV) ? MIN(timeLimit, LED_BLINK_TIME_LIMIT_HARSH_SITUATIONS) : timeLimit;
+    if (gain < 0)
+    {
+        mStokerDirection = -1;
+    }
+    else if (gain < mStokerLastGain)
+    {
+        mStokerDirection = -mStokerDirection;
+    }
     
-    // Variable length blink times, also ensuring blinkTime is non-zero
-    uint8_t blinkTime = ((randomInt ^ (randomInt >> 1)) & timeLimit) + 1;
+    mStokerLastGain = gain;
     
-    led_blink_prog_step_t currentStep;
+    next = (int8_t)mStokerLevel + mStokerDirection;
+    if (next < 0 || next >= (int8_t)(sizeof(cStokerLevels) / sizeof(cStokerLevels[0])))
+    {
+        // Turn around at the ends, except that backing off stays backed off
+        if (gain >= 0)
+        {
+            mStokerDirection = -mStokerDirection;
+            next = (int8_t)mStokerLevel + mStokerDirection;
+        }
+        else
+        {
+            next = (int8_t)mStokerLevel;
+        }
+    }
+    
+    mStokerLevel = (uint8_t)next;
+}
+
+// "Stoke" the harvest rail with a weak pullup, if the current level calls for it
+// at this opportunity
+static void led_stoke(void)
+{
+    const led_stoker_level_t* pLevel = NULL;
     
-    if (gPrefsCache.selfTestEn)
+    if (mStokerSlots && mStokerSlots <= LED_STOKER_EPOCH_SLOTS && !LED_stoker_measuring())
+    {
+        // The epoch stalled (twinkles gave way to an animation, say), so start over
+        mStokerSlots = 0;
+    }
+    else if (mStokerSlots == LED_STOKER_EPOCH_SLOTS)
+    {
+        led_adapt_stoker();
+    }
+    else if (mStokerSlots >= 2 * LED_STOKER_EPOCH_SLOTS)
+    {
+        mStokerSlots = 0;
+    }
+    
+    if (mStokerSlots == 0)
+    {
+        mStokerEpochStartCounts = gVccCounts;
+        mStokerEpochStartDuty = SUPERCAP_get_charge_duty();
+        mStokerEpochStartTick = gTickCount;
+    }
+    
+    mStokerSlots++;
+    
+    pLevel = &cStokerLevels[mStokerLevel];
+    if (pLevel->timeMs && mStokerSkipped >= pLevel->skip)
     {
-        // Show LEDs in sequence, ignoring the random order. Also make them
-        // super-bright
-        blinkTime = LED_SELF_TEST_LED_TEST_TIME_MS << 2; // convert ms to timer ticks
-        currentStep = cLedSelfTest[mLedCounter % LED_CYCLE_LENGTH];
-        
-        // Always enable the harvest stoker concurrent with whatever
         WPUC3 = 1;
+        TIMER_once(turnOffHarvestStoker, pLevel->timeMs << 2);
+        mStokerSkipped = 0;
     }
     else
     {
-        currentStep = cLedTwinkle[remainder];
+        mStokerSkipped++;
     }
+}
+
+#if FEATURE_SELF_TEST
+// Show the next step of the self-test sequence, ignoring the random order and
+// applying the preferences as it goes. Also make the LEDs super-bright
+static void led_self_test_step(void)
+{
+    uint8_t blinkTime = LED_SELF_TEST_LED_TEST_TIME_MS << 2; // convert ms to timer ticks
+    led_blink_prog_step_t currentStep = cLedSelfTest[mLedCounter % LED_CYCLE_LENGTH];
+    
+    // Always enable the harvest stoker concurrent with whatever
+    WPUC3 = 1;
         
     switch (currentStep.port)
     {
         case LED_PORT_A:
-            PORTA = (uint8_t)(1 << currentStep.pin);
-            TIMER_once(turnOffAllPortALeds, blinkTime);
-            break;
         case LED_PORT_B:
-            // Allow the tree star to be enabled or disabled
-            if (currentStep.pin != TREE_STAR_PIN ||
-                (gPrefsCache.treeStarEn || gPrefsCache.selfTestEn))
-            {
-                PORTB = (uint8_t)(1 << currentStep.pin);
-                TIMER_once(turnOffAllPortBLeds, blinkTime);
-            }
+            LED_frame_set(LED_PIN_INDEX(currentStep.port, currentStep.pin), blinkTime);
             break;
         case LED_PORT_C:
             // Allow the harvest LEDs to be enabled or disabled
             if (currentStep.pin == HARVEST_STOKE_PIN && gPrefsCache.harvestRailChargeEn)
             {
-                if (gVcc >= LED_HARVEST_STOKER_THRESH_HIGH_MV)
+                if (VCC_ABOVE_MV(LED_HARVEST_STOKER_THRESH_LOW_MV))
                 {
-                    // "Stoke" with a weak pullup
-                    WPUC3 = 1;
-                    TIMER_once(turnOffHarvestStoker, LED_HARVEST_STOKER_TIME_HIGH_MS << 2);
-                }
-                else if (gVcc >= LED_HARVEST_STOKER_THRESH_LOW_MV)
-                {
-                    // "Stoke" with a weak pullup
-                    WPUC3 = 1;
-                    TIMER_once(turnOffHarvestStoker, LED_HARVEST_STOKER_TIME_LOW_MS << 2);
+                    led_stoke();
                 }
             }
             else if (gPrefsCache.harvestBlinkEn)
             {
-                // Don't connect the output driver until now, since that itself will
-                // cause the LEDs to blink, and we don't want that high current drain on
-                // startup
                 TRISC &= ~((uint8_t)(1 << currentStep.pin));
-                
-                // Don't spoil the non-LED pins on port C
-                LATC = (LATC & PORT_C_NON_LED_MASK) | (uint8_t)(1 << currentStep.pin);
-                TIMER_once(turnOffAllPortCLeds, blinkTime);
+                LED_frame_set(LED_PIN_INDEX(LED_PORT_C, currentStep.pin), blinkTime);
             }
             break;
         case LED_IDLE:
@@ -206,13 +481,70 @@ void LED_twinkle(void)
             // nop
             break;            
     }
+}
+#endif
+
+// Pick up the twinkle schedule for the current preferences. Call whenever they change
+void LED_prefs_changed(void)
+{
+    mpTwinkleActions = cTwinkleActions[TWINKLE_SCHEDULE_INDEX(gPrefsCache)];
+}
+
+// Twinkle the tree LEDs. The tree star and harvest rules are already folded into
+// the schedule, so this is just a random step, a blink time, and a pulse
+void LED_twinkle(void)
+{   
+#if FEATURE_SELF_TEST
+    if (SELF_TEST_ACTIVE())
+    {
+        led_self_test_step();
+        mLedCounter++;
+        return;
+    }
+#endif
     
-    mLedCounter++; // will automatically wrap after 255 ticks
-    if (mLedCounter == UINT8_MAX)
+    uint8_t randomInt = ADC_random_int();
+    uint8_t step = ((randomInt + mLedCounter) % TWINKLE_SCHEDULE_LENGTH);
+         
+    // Limit power at startup no matter what the preferences say
+    uint8_t timeLimit = gPrefsCache.blinkTimeLimit;
+    timeLimit = (gTickCount < (2*TICKS_PER_SEC)) ? MIN(timeLimit, LED_BLINK_TIME_LIMIT_HARSH_SITUATIONS) : timeLimit;
+    
+    // Also limit power if VCC is low
+    timeLimit = VCC_BELOW_MV(LED_BLINK_LOW_THRESH_MV) ? MIN(timeLimit, LED_BLINK_TIME_LIMIT_HARSH_SITUATIONS) : timeLimit;
+    
+    // Variable length blink times, also ensuring blinkTime is non-zero
+    uint8_t blinkTime = ((randomInt ^ (randomInt >> 1)) & timeLimit) + 1;
+    
+    // Scale the on-time to the LED, for the same light from each (see led_calibration.h).
+    // Scales above 1.0 can take it past a byte
+    uint16_t scaledTime = ((uint16_t)blinkTime * cLedOnTimeScaleQ7[TWINKLE_PIN_INDEX(cTwinklePins[step])] + (1 << 6)) >> 7;
+    blinkTime = (uint8_t)MIN(MAX(scaledTime, 1), UINT8_MAX);
+    
+    switch (mpTwinkleActions[step])
     {
-        // Re-seed when we wrap. Keep it fresh! 
-        ADC_set_random_seed(ADC_get_random_state() ^ ADC_read_vcc_fast());
+        case TWINKLE_PULSE:
+            LED_frame_set(cTwinklePins[step], blinkTime);
+            break;
+        case TWINKLE_PULSE_HARVEST:
+            // Don't connect the output driver until now, since that itself will
+            // cause the LEDs to blink, and we don't want that high current drain on
+            // startup
+            TRISC &= (uint8_t)~cTwinkleMasks[step];
+            LED_frame_set(cTwinklePins[step], blinkTime);
+            break;
+        case TWINKLE_STOKE:
+            if (VCC_ABOVE_MV(LED_HARVEST_STOKER_THRESH_LOW_MV))
+            {
+                led_stoke();
+            }
+            break;
+        default:
+            // nop
+            break;            
     }
+    
+    mLedCounter++; // will automatically wrap after 255 ticks
 }
 
 // Show the RF level using what had been the NACK LED
@@ -241,14 +573,14 @@ void LED_show_power(uint8_t powerLevel)
         
         if (sCallCount < powerLevelScaled)
         {    
-            PORTA = (uint8_t)(1 << RF_LVL_LED_PIN);
-            TIMER_once(turnOffAllPortALeds, RF_LVL_BLINK_DURATION);
+            LED_frame_set(LED_PIN_INDEX(LED_PORT_A, RF_LVL_LED_PIN), RF_LVL_BLINK_DURATION);
         }
     }
 #define NUM_POWER_LEVELS_INCLUDING_OFF  (4)
     sCallCount = (sCallCount + 1) % (NUM_POWER_LEVELS_INCLUDING_OFF * 4);
 }
 
+#if FEATURE_SELF_TEST
 // Show the self-test state using the RF level LED
 void LED_show_self_test(void)
 {
@@ -256,7 +588,7 @@ void LED_show_self_test(void)
     
     self_test_step_t currentStep = SELF_TEST_get_current_step();
 
-    if (gPrefsCache.selfTestEn)
+    if (SELF_TEST_ACTIVE())
     {
         // Show the current step if the test hasn't completed, or blink green if it has
         if (currentStep < STS_COMPLETE)
@@ -264,24 +596,97 @@ void LED_show_self_test(void)
             // Test not yet completed
             if (sCallCount <= currentStep)
             {    
-                PORTA = (uint8_t)(1 << RF_LVL_LED_PIN);
-                TIMER_once(turnOffAllPortALeds, LED_SELF_TEST_STATUS_TIME_MS);
+                LED_frame_set(LED_PIN_INDEX(LED_PORT_A, RF_LVL_LED_PIN), LED_SELF_TEST_STATUS_TIME_MS);
             }
         }
         else
         {
-            PORTA = (uint8_t)(1 << RF_ACK_LED_PIN);
-            TIMER_once(turnOffAllPortALeds, LED_SELF_TEST_STATUS_TIME_MS);
+            LED_frame_set(LED_PIN_INDEX(LED_PORT_A, RF_ACK_LED_PIN), LED_SELF_TEST_STATUS_TIME_MS);
         }        
     }
 
     sCallCount = (sCallCount + 1) % (STS__NUM * 4);
 }
+#endif
 
 
 // Blink the RF command ACK LED
 void LED_blink_ack(void)
 {
-    PORTA = (uint8_t)(1 << RF_ACK_LED_PIN);
-    TIMER_once(turnOffAllPortALeds, RF_ACK_BLINK_DURATION);
+    LED_frame_set(LED_PIN_INDEX(LED_PORT_A, RF_ACK_LED_PIN), RF_ACK_BLINK_DURATION);
+}
+
+// Show the LEDs set in the frame this tick, scaled down as needed to fit the
+// frame's on-time budget for the available energy
+void LED_frame_show(void)
+{
+    uint8_t budget = VCC_BELOW_MV(LED_BLINK_LOW_THRESH_MV) ? LED_FRAME_BUDGET_LOW : LED_FRAME_BUDGET;
+    
+    // The self-test is meant to be super-bright
+    budget = SELF_TEST_ACTIVE() ? UINT8_MAX : budget;
+    uint16_t total = 0;
+    uint8_t shift = 0;
+    bool dimmed = false;
+    uint8_t i;
+    
+    if (LED_pulse_pending())
+    {
+        return;
+    }
+    
+    if (!mFrameCount)
+    {
+        // The last frame is over, so the dimming hardware can go
+        led_dimming_power(false);
+        return;
+    }
+    
+    for (i = 0; i < mFrameCount; i++)
+    {
+        total += mFrame[i].quarterMs;
+    }
+    
+    while ((total >> shift) > budget)
+    {
+        shift++;
+    }
+    
+    for (i = 0; i < mFrameCount; i++)
+    {
+        mFrame[i].quarterMs = MAX(mFrame[i].quarterMs >> shift, 1);
+        led_pulse_prepare(&mFrame[i]);
+        dimmed = dimmed || (mFrame[i].pps == LED_PULSE_PPS_DIMMED);
+    }
+    
+    led_dimming_power(dimmed);
+    
+    mFrameNext = 0;
+    mFrameScanning = true;
+    led_frame_next();
+}
+
+// Timer4 interrupt, at the end of each pulse of the frame but the last
+void LED_frame_scan(void)
+{
+    led_frame_next();
+}
+
+// True while the stoker is measuring an epoch, during which nothing else that
+// moves Vcc or the charge current (the power point tracker) should change
+bool LED_stoker_measuring(void)
+{
+    return (mStokerSlots && mStokerSlots <= LED_STOKER_EPOCH_SLOTS &&
+            gTickCount - mStokerEpochStartTick < LED_STOKER_EPOCH_MAX_TICKS);
+}
+
+// True while a frame's pulses still need the Timer4 interrupt to move on
+bool LED_frame_scanning(void)
+{
+    return mFrameScanning;
+}
+
+// True while a frame is still being shown, including its last pulse
+bool LED_pulse_pending(void)
+{
+    return mFrameScanning || T4CONbits.ON;
 }
@@ -2,14 +2,35 @@
 #define __LEDS_H
 
 #include "global.h"
+#include "vcc.h"
 
 // When the voltage is below this level, the situation is considered "low power" 
-// so the low time limit applies no matter the power mode
-#define LED_BLINK_LOW_THRESH_MV                 (2400) 
+// so the low time limit applies no matter the power mode. A supply guard level
+// (see vcc.h), so that it can be watched without full measurements
+#define LED_BLINK_LOW_LEVEL                     (14) // 2340 mV
+#define LED_BLINK_LOW_THRESH_MV                 VCC_LEVEL_MV(LED_BLINK_LOW_LEVEL)
 
+// The harvest stoker runs only above this level
+#define LED_HARVEST_STOKER_THRESH_LOW_MV        (2300) // Should be above the voltage at which the system will be powerd on LEDs alone
+
+// Cycle cost and deadline of the per-tick LED bookkeeping (twinkles, status
+// blinks, and working out the frame), used to pick the clock speed for it
+#define LED_TWINKLE_CYCLES                      (800)
+#define LED_TWINKLE_DEADLINE_US                 (400)
+
+void LED_prefs_changed(void);
 void LED_twinkle(void);
 void LED_blink_ack(void);
 void LED_show_power(uint8_t powerLevel);
+#if FEATURE_SELF_TEST
 void LED_show_self_test(void);
+#endif
+void LED_frame_set(uint8_t pinEntry, uint8_t quarterMilliseconds);
+bool LED_frame_set_checked(uint8_t pinEntry, uint8_t quarterMilliseconds);
+void LED_frame_show(void);
+void LED_frame_scan(void);
+bool LED_frame_scanning(void);
+bool LED_pulse_pending(void);
+bool LED_stoker_measuring(void);
 
 #endif
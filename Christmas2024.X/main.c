@@ -7,6 +7,11 @@
 #include "rf.h"
 #include "supercap.h"
 #include "self_test.h"
+#include "vcc.h"
+#include "profile.h"
+#include "trace.h"
+#include "anim.h"
+#include "nvm.h"
 
 #include <math.h>
 #include <stdint.h>
@@ -15,41 +20,147 @@
 
 // Macros and constants
 
-// For best performance, sample after a power of 2 ticks
-#define SAMPLE_VCC_EVERY_TICKS      (32)
+// LFINTOSC calibration. Timer0 increments (32 LFINTOSC cycles each) are timed
+// against the 500 kHz MFINTOSC, which is derived from the much more accurate HFINTOSC
+#define CAL_TMR0_INCREMENTS         (4)
+#define CAL_EVERY_TICKS             (60 * TICKS_PER_SEC)
+#define CAL_MFINTOSC_COUNTS_PER_MS  (500)
 
-// Increments above which high-latency timers will be used
-#define HIGH_LATENCY_TIMER_THRESH   (16 << 2) // multiplied by four due to the timer taking quarter-ms increments
+// Timer0 counts per tick are this divided by the measurement, and Timer6 counts
+// per quarter-millisecond (in Q7) are CAL_T6_Q7_NUMERATOR divided by the measurement
+#define CAL_TICK_NUMERATOR          ((1000UL / TICKS_PER_SEC) * CAL_MFINTOSC_COUNTS_PER_MS * CAL_TMR0_INCREMENTS)
+#define CAL_T6_Q7_NUMERATOR         ((CAL_MFINTOSC_COUNTS_PER_MS * CAL_TMR0_INCREMENTS * 32UL / 8UL / 4UL) << 7) // Timer0 prescale of 32, Timer6 prescale of 8
+
+// Nominal Timer6 counts per quarter-millisecond in Q7 (31 kHz / 8 * 0.25 ms)
+#define CAL_T6_Q7_NOMINAL           (124)
+
+// Polling for a Timer0 increment takes about 6 cycles per loop. Keep that within
+// 4 us so edge detection adds no more than about 0.1% to the measurement
+#define CAL_POLL_CYCLES             (6)
+#define CAL_POLL_DEADLINE_US        (4)
+
+// Staged boot. Only what the tick itself needs is set up before the first tick;
+// the rest comes a stage per tick once Vcc is up to it, or regardless once the
+// card has been up for a while (Vcc isn't measured for the first second)
+#define BOOT_STAGE_MIN_MV           (2200)
+#define BOOT_STAGE_TIMEOUT_TICKS    (3 * TICKS_PER_SEC)
 
 // Make sampling of RF voltages more random
 #define RF_SAMPLING_MASK    (0x0F)
-#define WHITENING           (0x5A)
 
 // Typedefs 
 
 
+// The HFINTOSC settings are in the same order as the OSCFRQ codes, starting from 
+// 0b000 for CLK_MED
 typedef enum
 {
-    CLK_SLOW,
-    CLK_MED,
-    CLK_FAST
+    CLK_SLOW,   // 15.5 kHz LFINTOSC
+    CLK_MED,    // 1 MHz HFINTOSC
+    CLK_2MHZ,
+    CLK_4MHZ,
+    CLK_8MHZ,
+    CLK_12MHZ,
+    CLK_FAST,   // 16 MHz HFINTOSC
+    CLK__NUM
 } clock_speed_t;
 
+// Boot milestones, in order
+typedef enum
+{
+    BOOT_TICKING,       // KEEP_ON_PIN, GPIO, the tick and callback timers
+    BOOT_PERIPHERALS,   // LED pulse and PWM hardware
+    BOOT_PREFS,         // Preferences and animation program loaded
+    BOOT_DONE = BOOT_PREFS,
+    BOOT__NUM
+} boot_stage_t;
+
+// Work done during the system tick, each run at its own clock speed
+typedef enum
+{
+    TASK_SELF_TEST,
+    TASK_VCC,
+    TASK_RF_LEVEL,
+    TASK_RF_SAMPLE,
+    TASK_SUPERCAP,
+    TASK_LEDS,
+    TASK_CALIBRATION,
+    TASK_ANIM,
+    TASK_SUPERCAP_MODEL,
+    TASK__NUM
+} task_t;
+
+// True if the given number of instruction cycles (Fosc/4) completes within the deadline at the given Fosc
+#define CYCLES_FIT(_cycles, _deadlineUs, _mhz)  ((uint32_t)(_cycles) * 4u <= (uint32_t)(_deadlineUs) * (_mhz))
+
+// The slowest HFINTOSC setting that still meets a task's deadline
+#define CLK_FOR_TASK(_cycles, _deadlineUs)      (CYCLES_FIT(_cycles, _deadlineUs, 1) ? CLK_MED : \
+                                                 CYCLES_FIT(_cycles, _deadlineUs, 2) ? CLK_2MHZ : \
+                                                 CYCLES_FIT(_cycles, _deadlineUs, 4) ? CLK_4MHZ : \
+                                                 CYCLES_FIT(_cycles, _deadlineUs, 8) ? CLK_8MHZ : \
+                                                 CYCLES_FIT(_cycles, _deadlineUs, 12) ? CLK_12MHZ : CLK_FAST)
+
+// A pending timer callback may be serviced up to half of its delay late. A delay of
+// (T6PR + 1) quarter-milliseconds thus allows 125 * (T6PR + 1) us, so a clock running at
+// the given rate (in units of 500 Hz) can service callbacks only for T6PR at or above this
+#define TIMER_MIN_PR_FOR_RATE(_halfKhz)         MIN(UINT8_MAX, (TIMER_CALLBACK_CYCLES * 64UL + (_halfKhz) - 1) / (_halfKhz) - 1)
+
 // Non-macro constants
 
+static const clock_speed_t cTaskClock[TASK__NUM] = 
+{
+    [TASK_SELF_TEST] = CLK_FOR_TASK(SELF_TEST_UPDATE_CYCLES, SELF_TEST_UPDATE_DEADLINE_US),
+    [TASK_VCC] = CLK_FOR_TASK(MAX(ADC_READ_VCC_CYCLES, VCC_GUARD_CYCLES), ADC_READ_VCC_DEADLINE_US),
+    [TASK_RF_LEVEL] = CLK_FOR_TASK(RF_UPDATE_SLICER_CYCLES, RF_UPDATE_SLICER_DEADLINE_US),
+    [TASK_RF_SAMPLE] = CLK_FOR_TASK(RF_SAMPLE_BIT_CYCLES, RF_SAMPLE_BIT_DEADLINE_US),
+    [TASK_SUPERCAP] = CLK_FOR_TASK(SUPERCAP_CHARGE_CYCLES, SUPERCAP_CHARGE_DEADLINE_US),
+    [TASK_LEDS] = CLK_FOR_TASK(LED_TWINKLE_CYCLES, LED_TWINKLE_DEADLINE_US),
+    [TASK_CALIBRATION] = CLK_FOR_TASK(CAL_POLL_CYCLES, CAL_POLL_DEADLINE_US),
+    [TASK_ANIM] = CLK_FOR_TASK(ANIM_STEP_CYCLES, ANIM_STEP_DEADLINE_US),
+    [TASK_SUPERCAP_MODEL] = CLK_FOR_TASK(SUPERCAP_CHARGE_CYCLES + SUPERCAP_MODEL_STEP_CYCLES, SUPERCAP_MODEL_DEADLINE_US),
+};
+
+static const uint8_t cTimerMinPrForClock[CLK__NUM] = 
+{
+    [CLK_SLOW] = TIMER_MIN_PR_FOR_RATE(31),
+    [CLK_MED] = TIMER_MIN_PR_FOR_RATE(2000),
+    [CLK_2MHZ] = TIMER_MIN_PR_FOR_RATE(4000),
+    [CLK_4MHZ] = TIMER_MIN_PR_FOR_RATE(8000),
+    [CLK_8MHZ] = TIMER_MIN_PR_FOR_RATE(16000),
+    [CLK_12MHZ] = TIMER_MIN_PR_FOR_RATE(24000),
+    [CLK_FAST] = 0,
+};
+
 // Module variables
 // Goes true when Timer 0 has expired
 static bool mUnhandledSystemTick = false;
 
+// True while the system tick is being handled, so that timer callbacks don't 
+// drop the clock out from under the tick's tasks
+static bool mTickInProgress = false;
+
 // During bootup, we manually set the clock to 16 MHz, so set the internal state
 // accordingly
 static clock_speed_t mSystemClock = CLK_FAST;
 
 static func_t mpTimerExpireCallback = NULL;
 
+// Timer6 counts per quarter-millisecond in Q7, corrected for the measured LFINTOSC rate.
+// Wider than a byte, as a fast LFINTOSC at the edge of the plausible range gives 256
+static uint16_t mTimer6ScaleQ7 = CAL_T6_Q7_NOMINAL;
+
+// Calibrate as soon as the startup period is over
+static bool mCalibrationDue = true;
+
+// TIMER2_USER_... bits of whatever needs Timer2 running
+static uint8_t mTimer2Users = 0;
+
 uint32_t gTickCount = 0; // absolute tick count
 
-extern uint16_t gVcc;
+// Boot progress, and the tick at which each milestone was reached (for a debugger,
+// and written out by the profiler)
+static boot_stage_t mBootStage = BOOT_TICKING;
+static uint16_t mBootMilestoneTicks[BOOT__NUM];
 
 // Global variables and pseudo-variables
 
@@ -57,7 +168,7 @@ extern uint16_t gVcc;
 
 // Function implementations
 
-// Setup of the pins and peripherals
+// Setup of the pins and the peripherals that the tick needs from the start
 void setup(void)
 {   
     //
@@ -100,7 +211,7 @@ void setup(void)
     T0EN = 0; // Timer off for now
     TMR0IF = 0; // Clear interrupt flag
     TMR0IE = 1; // Enable interrupts
-    TMR0H = 48; // (tick count is this number + 1) interrupt every 50 ms    
+    TMR0H = 48; // (tick count is this number + 1) interrupt every 50 ms, refined by calibrate_lfintosc()
     TMR0L = 0;
     
     // Timer6 -- Programmable callback
@@ -117,11 +228,11 @@ void setup(void)
     // the interstitial periods at 15.5 kHz, resulted in a current-consumption reduction at 2.0 V
     // of about 750 nA (versus not disabling these modules with PMD)
     PMD0 = 0b00011011; // Disable CRC module, program memory scanner, clock reference, GPIO interrupt-on-change
-    PMD1 = 0b10111110; // Disable all timers except TMR6 and TMR0
+    PMD1 = 0b10111110; // Disable all timers except TMR6 and TMR0 (TMR4 is powered up by setup_peripherals(), TMR2 while TIMER2_use() says it's needed, TMR3 briefly for calibration, TMR1 by the profiler)
     PMD2 = 0b00000001; // Disable zero-crossing detector
-    PMD3 = 0b11111111; // Disable all CCP modules and PWM modules
+    PMD3 = 0b11111111; // Disable all CCP modules and PWM modules (PWM7 is powered up by setup_peripherals(), CCP1 for dimmed LED pulses, PWM6 for regulated charging)
     PMD4 = 0b11111111; // Disable all UARTs, serial modules, and complementary waveform generators
-    PMD5 = 0b11111111; // Disable all signal measurement timers, CLCs, and DSMs
+    PMD5 = 0b11111111; // Disable all signal measurement timers, CLCs, and DSMs (CLC1 is powered up for dimmed LED pulses)
     
     // Enable idle mode
     CPUDOZEbits.IDLEN = 1;
@@ -133,111 +244,310 @@ void setup(void)
     WDTCON0bits.SWDTEN = 1;
 }
 
-// Allow the system clock to be switched among 15.5 kHz, 1 MHz, and 16 MHz
-// Handles all of the timer clock divider changes so that items based on Fosc
-// continue operating normally.
-void switchSystemClock(bool fast)
+// Setup of the peripherals that can wait for the boot to get that far (see
+// boot_advance()). Nothing uses them until then
+static void setup_peripherals(void)
 {
+    PMD1bits.TMR4MD = 0;
+    PMD3bits.PWM7MD = 0;
+    
+    // Timer4 -- LED pulse one-shot, the timebase for PWM7 (see led_pulse_start() in leds.c)
+    T4CLKCON = 0x04; // LFINTOSC (31 kHz))
+    T4HLT = 0b01000; // One-shot, started by software; ON clears itself at the period match
+    T4CON = 0b00110000; // Off, 1:8 prescaler (the same rate as Timer6)
+    CCPTMRS1bits.P7TSEL = 0b10; // PWM7 off Timer4
+    PWM7CON = 0b10000000; // Enabled, active high
+}
+
+// Allow the system clock to be switched among 15.5 kHz and the 1-16 MHz HFINTOSC settings.
+// Timers run from the LFINTOSC and the ADC from its FRC, so nothing else needs
+// to change along with Fosc
+static void setSystemClock(clock_speed_t speed)
+{
+    clock_speed_t previous = mSystemClock;
+    
     // Early return if there is no change
-    if (fast && 
-        CLK_FAST == mSystemClock)
+    if (speed == previous)
     {
         return;
     }
     
-    if (!fast &&
-        CLK_SLOW == mSystemClock)
+    // Trace the change at the faster of the two clocks (see trace.h)
+    if (speed < previous)
     {
-        return;
+        TRACE(TRACE_CLOCK, speed);
     }
-        
-    if (fast)
+    
+    if (CLK_SLOW == speed)
+    {
+        // Switch to the LFINTOSC, which is always ready, and divide by 2 for extra power savings
+        OSCCON1 = 0b101 << 4 | 0b0001; // LFINTOSC, 31 kHz divide by 2. Net = 15.5 kHz
+    }
+    else
     {
-        // Switch to fast clock
         // Don't bother letting the clock stabilize, because it doesn't matter
         // for this application
-        OSCFRQ = 0b101; // 16 MHz HFINTOSC
-        OSCCON1 = 0b110 << 4 | 0b0000; // HFINTOSC, divisor 1, 16 MHz net
+        OSCFRQ = (uint8_t)(speed - CLK_MED);
         
-        mSystemClock = CLK_FAST;
+        // Only need to switch the source if we're coming from the LFINTOSC
+        if (CLK_SLOW == mSystemClock)
+        {
+            OSCCON1 = 0b110 << 4 | 0b0000; // HFINTOSC, divisor 1
+        }
     }
-    else
+    
+    mSystemClock = speed;
+    
+    if (speed > previous)
+    {
+        TRACE(TRACE_CLOCK, speed);
+    }
+}
+
+// The slowest clock that still services any pending timer callback, or the next
+// step of an LED frame scan, within its deadline. Timer4 runs at the same rate as
+// Timer6, and the scan's interrupt costs no more than a callback. A lone pulse
+// (or the last of a frame) ends without an interrupt, so it doesn't hold the clock
+static clock_speed_t idleSystemClock(void)
+{
+    clock_speed_t speed = CLK_SLOW;
+    uint8_t pr = UINT8_MAX;
+    
+    if (mpTimerExpireCallback)
     {
-        // Keep clock running faster if we have a pending high-resolution timer expiration, unless
-        // that high-res timer's callback is particularly long way into the future
-        if (mpTimerExpireCallback && 
-            T6PR < HIGH_LATENCY_TIMER_THRESH)
+        pr = T6PR;
+    }
+    
+    if (LED_frame_scanning())
+    {
+        pr = MIN(pr, T4PR);
+    }
+    
+    if (mpTimerExpireCallback || LED_frame_scanning())
+    {
+        while (speed < CLK_FAST &&
+               pr < cTimerMinPrForClock[speed])
         {
-            mSystemClock = CLK_MED;
-            
-            // 1 MHz system clock 
-            OSCFRQ = 0b000; // 1 MHz HFINTOSC
-            
-            // we should already be running with these settings (notably a divisor of 1) at this point, 
-            // assuming we never go from 15 kHz -> 1 MHz, so no need to write them again
-//            OSCCON1 = 0b110 << 4 | 0b0000; // HFINTOSC, which we configured to be 16 MHz in setup()
+            speed++;
         }
-        else
-        {
-            mSystemClock = CLK_SLOW;
+    }
+    
+    return speed;
+}
 
-            // Switch to the LFINTOSC, which is always ready, and divide by 2 for extra power savings
-            OSCCON1 = 0b101 << 4 | 0b0001; // LFINTOSC, 31 kHz divide by 2. Net = 15.5 kHz
-        }
+// Run the next bit of work at the clock speed its profile calls for
+static void clockForTask(task_t task)
+{
+    TRACE(TRACE_TASK, task);
+    
+    setSystemClock(cTaskClock[task]);
+}
+
+// Measure the LFINTOSC against the HFINTOSC and correct the Timer0 (system tick)
+// and Timer6 (callback) periods accordingly. The LFINTOSC drifts a lot with
+// temperature and voltage, and everything from the RF symbol timing to the
+// LED on-times depends on it. Takes about 5 ms with interrupts disabled, so run
+// it only when no timer callback is pending and early in a tick (so that the
+// Timer0 period doesn't end during the measurement)
+static void calibrate_lfintosc(void)
+{
+    uint8_t tmr0 = 0;
+    uint16_t counts = 0;
+    
+    // Timer3 -- Calibration reference, powered only for the measurement
+    PMD1bits.TMR3MD = 0;
+    T3CLK = 0b0101; // MFINTOSC (500 kHz)
+    T3CON = 0b00000100; // 1:1 prescaler, not synchronized, off
+    TMR3H = 0;
+    TMR3L = 0;
+    
+    // An interrupt in the middle would delay edge detection
+    di();
+    
+    // Align to a Timer0 increment, then time the next few
+    tmr0 = TMR0L;
+    while (TMR0L == tmr0);
+    
+    TMR3ON = 1;
+    
+    for (uint8_t i = 0; i < CAL_TMR0_INCREMENTS; i++)
+    {
+        tmr0 = TMR0L;
+        while (TMR0L == tmr0);
+    }
+    
+    TMR3ON = 0;
+    
+    ei();
+    
+    counts = (uint16_t)(TMR3H << 8) | TMR3L;
+    
+    PMD1bits.TMR3MD = 1;
+    
+    // Ignore implausible results (more than a factor of two off nominal) rather
+    // than derailing the system tick
+    if (counts > (CAL_TICK_NUMERATOR / 100) &&
+        counts < (CAL_TICK_NUMERATOR / 25))
+    {
+        // Round to the nearest count. The timer match effectively adds one, so compensate for that
+        TMR0H = (uint8_t)((CAL_TICK_NUMERATOR + counts / 2) / counts) - 1;
+        
+        mTimer6ScaleQ7 = (uint16_t)((CAL_T6_Q7_NUMERATOR + counts / 2) / counts);
     }
 }
 
+// Convert quarter milliseconds to counts of a timer running off the LFINTOSC with
+// a 1:8 prescaler (Timer4 or Timer6), corrected for the calibrated LFINTOSC rate.
+// Clipped to 1-256 counts
+uint16_t TIMER_quarter_ms_to_counts(uint8_t quarterMilliseconds)
+{
+    uint16_t counts = (uint16_t)(((uint16_t)quarterMilliseconds * mTimer6ScaleQ7 + (1 << 6)) >> 7);
+    
+    counts = MIN(counts, UINT8_MAX + 1);
+    counts = MAX(counts, 1);
+    
+    return counts;
+}
+
 // Set up a timer to call the callback in the specified time
-// Does no bounds checking. Increments are quarter milliseconds (i.e., to 
-// have a 1 ms timeout, pass a value of 4), though note that there is about 100 us of overhead
-// If the delay is longer than 16 ms, the timeout will be serviced with the
-// sysclock set to the LTFINTOSC, so latency will be high (but power consumption
-// will be low)
+// Increments are quarter milliseconds (i.e., to have a 1 ms timeout, pass a value
+// of 4), corrected for the calibrated LFINTOSC rate, though note that there is about
+// 100 us of overhead. Delays that don't fit the timer are clipped to its maximum
+// While the callback is pending, the sysclock idles at the slowest speed that can
+// still service it within half of the delay, so long delays (about 30 ms or more)
+// are serviced from the LFINTOSC with high latency (but low power consumption)
 void TIMER_once(func_t pCallback, uint8_t quarterMilliseconds)
 {
     // Start a new timer only if we don't already have one pending
     if (!mpTimerExpireCallback && 
         quarterMilliseconds > 0)
     {
+        uint16_t counts = TIMER_quarter_ms_to_counts(quarterMilliseconds);
+        
         TMR6 = 0;
         mpTimerExpireCallback = pCallback;
         
         // The timer match effectively adds one, so compensate for that
-        T6PR = quarterMilliseconds - 1;
+        T6PR = (uint8_t)(counts - 1);
         
         TMR6IF = 0;
         TMR6IE = 1;
         TMR6ON = true;
+        
+        TRACE(TRACE_TIMER_SET, quarterMilliseconds);
     }
 }
 
 
+// Start or stop Timer2, the shared PWM timebase, for one of its users. It runs
+// while any of them needs it, and is powered down otherwise. Call only from the
+// tick, not from an interrupt
+void TIMER2_use(uint8_t user, bool inUse)
+{
+    uint8_t users = inUse ? (mTimer2Users | user) : (mTimer2Users & (uint8_t)~user);
+    
+    if (users && !mTimer2Users)
+    {
+        // Powering it up through PMD resets it, so set it up afresh
+        PMD1bits.TMR2MD = 0;
+        T2CLKCON = 0x04; // LFINTOSC (31 kHz)
+        T2HLT = 0b00000000; // Free-running, period set by T2PR
+        T2PR = TIMER2_PWM_PR;
+        TMR2 = 0;
+        T2CON = 0b10000000; // On, no prescaler or postscaler
+    }
+    else if (!users && mTimer2Users)
+    {
+        T2CON = 0b00000000;
+        PMD1bits.TMR2MD = 1;
+    }
+    
+    mTimer2Users = users;
+}
+
+// Timestamp the boot stage just reached
+static void boot_milestone(void)
+{
+    mBootMilestoneTicks[mBootStage] = (uint16_t)gTickCount;
+    PROFILE_MILESTONE(mBootStage, gTickCount);
+}
+
+// Take the next boot stage, if Vcc is up to it or the card has waited long 
+// enough, and timestamp it
+static void boot_advance(void)
+{
+    if (mBootStage == BOOT_DONE ||
+        (VCC_BELOW_MV(BOOT_STAGE_MIN_MV) && gTickCount < BOOT_STAGE_TIMEOUT_TICKS))
+    {
+        return;
+    }
+    
+    switch (mBootStage)
+    {
+        case BOOT_TICKING:
+            setup_peripherals();
+            break;
+        case BOOT_PERIPHERALS:
+            // Cache load. Until now, every preference is off
+            PREFS_init();
+            
+            // Pick up any animation program
+            ANIM_init();
+            break;
+        default:
+            break;
+    }
+    
+    mBootStage++;
+    boot_milestone();
+}
+
 void system_tick_handler(void)
 {
     static bool sChargingCap = false;
     static uint8_t sRfLevel = 0;
     
+    boot_advance();
+    
     // Avoid almost all of the slower work if we've just started up, as we might
     // be in an extremely compromised power state
     if (gTickCount > (1*TICKS_PER_SEC))
     {
+        // Keep the LFINTOSC-based timing honest. Do this first, while Timer0
+        // has most of its period left
+        if (gTickCount % CAL_EVERY_TICKS == 0)
+        {
+            mCalibrationDue = true;
+        }
+        
+        if (mCalibrationDue &&
+            !mpTimerExpireCallback)
+        {
+            clockForTask(TASK_CALIBRATION);
+            calibrate_lfintosc();
+            mCalibrationDue = false;
+        }
+        
         // Service self-test mode if it's still relevant
-        if (gPrefsCache.selfTestEn)
+        if (SELF_TEST_ACTIVE())
         {
+            clockForTask(TASK_SELF_TEST);
             SELF_TEST_state_machine_update();
         }
                 
-        // Measure VDD with the ADC using the FVR about once every other second or on every tick 
-        // if we're charging the supercap (so as to avoid brownout), but not just after startup
-        if (gTickCount % SAMPLE_VCC_EVERY_TICKS == 0 ||
-            sChargingCap)
+        // Measure VDD with the ADC using the FVR as often as its trend calls for (from
+        // every tick to about every three seconds), but not just after startup
+        bool vccDue = VCC_measurement_due();
+        
+        // While charging the supercap, watch VDD on every tick (so as to avoid brownout), 
+        // but measure it only if the supply guard says it might have crossed a threshold
+        if (!vccDue && sChargingCap)
         {
-            gVcc = ADC_read_vcc();
+            clockForTask(TASK_VCC);
+            vccDue = VCC_guard_tripped();
         }
         
-        // Whiten the "random" number because the LFSR gives long runs of similar lower bits.
-        // This significantly improves the uniformity of the distribution of RF level sampling
-        uint8_t moduloMatch = (RF_SAMPLING_MASK & (WHITENING ^ ADC_get_random_state()));
+        uint8_t moduloMatch = (RF_SAMPLING_MASK & ADC_random_int());
 
         // Measure the RF level with the ADC about once per second and add it to the running average to set the slicer
         // and detect whether there's any RF available to possibly decode.
@@ -247,44 +557,121 @@ void system_tick_handler(void)
         // a 90% chance of sampling within 400 ms,
         // and a 99% chance of sampling within 800 ms
         // Given that the sampling history runs 8 deep, the history will cover about 1.2 seconds on average but between 0.4 s and 6 seconds 99% of the time
-        if (moduloMatch < 0x04) 
+        bool rfLevelDue = (moduloMatch < 0x04);
+        
+        // Do the conversions back to back, with the core idle while they run.
+        // ADC_read_vcc() and RF_update_slicer_level() pick up the results
+        if (vccDue || rfLevelDue)
         {
+            if (vccDue)
+            {
+                ADC_queue(ADC_REQ_VCC);
+            }
+            
+            if (rfLevelDue)
+            {
+                ADC_queue(ADC_REQ_RF);
+            }
+            
+            clockForTask(TASK_VCC);
+            PROFILE_START(PROF_ADC_READ_VCC);
+            ADC_run_queue();
+            PROFILE_STOP(PROF_ADC_READ_VCC);
+        }
+        
+        if (vccDue)
+        {
+            VCC_measured(ADC_read_vcc());
+            TRACE(TRACE_VCC, gVccCounts);
+        }
+        
+        if (rfLevelDue) 
+        {
+            clockForTask(TASK_RF_LEVEL);
             sRfLevel = RF_update_slicer_level();
         }
         
-        RF_sample_bit();
+        // Commands change the preferences, so they wait for them to be loaded
+        if (mBootStage == BOOT_DONE)
+        {
+            clockForTask(TASK_RF_SAMPLE);
+            PROFILE_START(PROF_RF_SAMPLE_BIT);
+            RF_sample_bit();
+            PROFILE_STOP(PROF_RF_SAMPLE_BIT);
+        }
     
         // Charge the supercap if we're feeling spicy
-        sChargingCap = SUPERCAP_charge();
+        clockForTask(SUPERCAP_model_step_due() ? TASK_SUPERCAP_MODEL : TASK_SUPERCAP);
+        PROFILE_START(PROF_SUPERCAP_CHARGE);
+        bool chargingCap = SUPERCAP_charge();
+        PROFILE_STOP(PROF_SUPERCAP_CHARGE);
+        
+        // Starting or stopping charging changes the load enough to throw off the Vcc trend
+        if (chargingCap != sChargingCap)
+        {
+            VCC_load_changed();
+        }
+        
+        sChargingCap = chargingCap;
+        
+        // Start any queued EEPROM writes, now that charging has stood down for them
+        NVM_service();
     }
     
-    // If we're not twinkling or using the fast callback timer for some other reason (like ACKing RF commands) show the RF status
-    if ((gTickCount & 1))
+    // The LEDs wait for their peripherals and the preferences
+    if (mBootStage == BOOT_DONE)
     {
-        if (!mpTimerExpireCallback)
+        clockForTask(TASK_LEDS);
+        
+        // If we're not twinkling or using the fast callback timer for some other reason (like ACKing RF commands) show the RF status
+        if ((gTickCount & 1))
+        {
+            if (!mpTimerExpireCallback && !LED_pulse_pending())
+            {
+#if FEATURE_SELF_TEST
+                if (SELF_TEST_ACTIVE())
+                {
+                    LED_show_self_test();
+                }
+                else
+#endif
+                {
+                    LED_show_power(sRfLevel);
+                }
+            }
+        }
+        
+        // An animation program in EEPROM takes the place of the twinkles, and keeps
+        // its own time. The self-test always uses the built-in sequence
+        if (ANIM_running() && !SELF_TEST_ACTIVE())
         {
-            if (gPrefsCache.selfTestEn)
+            if (!LED_pulse_pending())
             {
-                LED_show_self_test();
+                clockForTask(TASK_ANIM);
+                ANIM_step();
             }
             else
             {
-                LED_show_power(sRfLevel);
+                ANIM_step_skipped();
             }
         }
-    }
-    
-    // Twinkle the LEDs, but only if we don't already have a status LED showing and only on every other tick (10 Hz)
-    // Blink only every tick for normal power, skipping the rest of this.
-    // NOTE: This is not an "else" to the RF blink!
-    if ((gTickCount & 1) == 0 ||
-            (gPrefsCache.fastBlinksEn && gVcc > LED_BLINK_LOW_THRESH_MV) || gPrefsCache.selfTestEn)
-    {
-        if (!mpTimerExpireCallback)
+        // Twinkle the LEDs on every other tick (10 Hz), in the same frame as any status LED
+        // Blink only every tick for normal power, skipping the rest of this.
+        // NOTE: This is not an "else" to the RF blink!
+        else if ((gTickCount & 1) == 0 ||
+                (gPrefsCache.fastBlinksEn && VCC_ABOVE_MV(LED_BLINK_LOW_THRESH_MV)) || SELF_TEST_ACTIVE())
         {
-            LED_twinkle();
-        }
-    }    
+            if (!mpTimerExpireCallback && !LED_pulse_pending())
+            {
+                PROFILE_START(PROF_LED_TWINKLE);
+                LED_twinkle();
+                PROFILE_STOP(PROF_LED_TWINKLE);
+            }
+        }    
+        
+        // Light everything set for this tick (twinkles, status, ACKs) together
+        LED_frame_show();
+    }
     
     // Pet watchdog
     CLRWDT();
@@ -305,6 +692,7 @@ void main(void)
     OSCCON1 = 0b110 << 4 | 0b0000; // HFINTOSC, divisor 1, 16 MHz net
 
     setup();
+    PROFILE_init();
     ei();
     
 #ifdef EXPOSE_FOSC_ON_PIN    
@@ -317,11 +705,10 @@ void main(void)
     CLKRCONbits.CLKREN = 1; // enable clock output
 #endif
             
-    // Cache load
-    PREFS_init();
+    // The preferences and the rest of the peripherals come later (see boot_advance())
 
-    // Seed the random number generator with entropy. Do only one call, since 
-    ADC_set_random_seed(ADC_read_vcc_fast());
+    // Ticking starts now, at tick 0
+    boot_milestone();
 
     // Service the system tick immediately
     mUnhandledSystemTick = true;
@@ -341,9 +728,19 @@ void main(void)
             // another 2 us. At 16 MHz Fosc, that's 8 instructions, fewer if
             // branches are involved
             BORCON = 0x80; // Enable BOR detection temporarily
+            TRACE(TRACE_BOR, 1);
             
             // Do the appropriate actions for the current state
+            mTickInProgress = true;
+            TRACE(TRACE_TICK_BEGIN, gTickCount);
+            PROFILE_START(PROF_SYSTEM_TICK);
             system_tick_handler();
+            PROFILE_STOP(PROF_SYSTEM_TICK);
+            TRACE(TRACE_TICK_END, gTickCount);
+            mTickInProgress = false;
+            
+            // Write out the profiler counters a little at a time (profiler builds only)
+            PROFILE_flush();
             gTickCount++;
             
             // Disable BOR detection to save power (consumes 9 uA when active)
@@ -352,9 +749,10 @@ void main(void)
             if (!mpTimerExpireCallback)
             {
                 BORCON = 0x00; // Disable BOR detection
+                TRACE(TRACE_BOR, 0);
             }
             
-            switchSystemClock(false);
+            setSystemClock(idleSystemClock());
         }
 
         // Wait for next interrupt
@@ -373,7 +771,7 @@ void __interrupt() isr(void)
         // PROMPTLY speed up the system clock, then clean up with a normal call
         OSCFRQ = 0b101; // 16 MHz HFINTOSC
         OSCCON1 = 0b110 << 4 | 0b0000; // HFINTOSC, divisor 1, 16 MHz net
-        switchSystemClock(true);
+        setSystemClock(CLK_FAST);
         
         mUnhandledSystemTick = true;
 
@@ -381,6 +779,24 @@ void __interrupt() isr(void)
         // Timer auto-reloads
     }
     
+    // NVM -- A queued EEPROM write has finished
+    if (NVMIE && NVMIF)
+    {
+        NVM_write_done();
+    }
+    
+    // Timer 4 -- End of an LED pulse, on to the next LED of the frame
+    if (TMR4IE && TMR4IF)
+    {
+        LED_frame_scan();
+        
+        // Once the last pulse is under way, there's nothing left to hold the clock for
+        if (!LED_frame_scanning() && !mTickInProgress)
+        {
+            setSystemClock(idleSystemClock());
+        }
+    }
+    
     // Timer 6 -- Programmable timer callback
     if (TMR6IE && TMR6IF)
     {
@@ -388,11 +804,18 @@ void __interrupt() isr(void)
         
         if (mpTimerExpireCallback)
         {
+            TRACE(TRACE_TIMER_FIRE, 0);
             mpTimerExpireCallback();
             mpTimerExpireCallback = NULL;        
             TMR6ON = false;
             BORCON = 0x00; // Disable BOR detection
-            switchSystemClock(false);            
+            TRACE(TRACE_BOR, 0);
+            
+            // The tick picks its own clocks and drops to the idle clock when it's done
+            if (!mTickInProgress)
+            {
+                setSystemClock(idleSystemClock());
+            }
         }
     }
  
@@ -0,0 +1,229 @@
+#include "nvm.h"
+#include "global.h"
+#include "adc.h"
+
+// Macros and constants
+
+// The data EEPROM sits at 0xF000 in the NVMREGS address space
+#define NVM_EEPROM_ADDR_HIGH        (0xF0)
+
+// Queued writes. A write to an address that's already waiting replaces its value.
+// Room for two preference journal records: one being written, and one waiting
+// (which later changes are folded into; see prefs_journal_write())
+#define NVM_QUEUE_LEN               (8)
+
+// Queued writes wait for at least this much Vcc, as a write draws a lot of 
+// current for a couple of milliseconds
+#define NVM_WRITE_MIN_MV            (2200)
+
+// Typedefs
+
+typedef struct
+{
+    uint8_t     addr;
+    uint8_t     value;
+} nvm_write_t;
+
+// Variables
+
+static nvm_write_t mQueue[NVM_QUEUE_LEN];
+static volatile uint8_t mQueueHead = 0;
+static volatile uint8_t mQueueCount = 0;
+
+// True while the write at the head of the queue is in progress
+static volatile bool mWriting = false;
+
+// Implementations
+
+// Start one write, without waiting for it to finish
+static void nvm_start(uint8_t addr, uint8_t value)
+{
+    bool interruptsEnabled = GIE;
+    
+    NVMADRH = NVM_EEPROM_ADDR_HIGH;
+    NVMADRL = addr;
+    NVMDATL = value;
+    
+    NVMCON1 = 0b01000100; // NVMREGS, write enable
+    
+    // The unlock sequence must not be interrupted
+    GIE = 0;
+    NVMCON2 = 0x55;
+    NVMCON2 = 0xAA;
+    NVMCON1bits.WR = 1;
+    GIE = interruptsEnabled;
+}
+
+// Start the write at the head of the queue, finishing in NVM_write_done()
+static void nvm_start_queued(void)
+{
+    mWriting = true;
+    NVMIF = 0;
+    NVMIE = 1;
+    nvm_start(mQueue[mQueueHead].addr, mQueue[mQueueHead].value);
+}
+
+// Read one byte of data EEPROM at the given offset. A byte with a write queued
+// reads back as the queued value, without waiting. Otherwise, if a write is in
+// progress, this waits for it to finish (up to a few milliseconds)
+uint8_t NVM_read_eeprom(uint8_t addr)
+{
+    bool interruptsEnabled = GIE;
+    uint8_t value;
+    uint8_t i;
+    
+    // The NVM interrupt would start the next queued write in the middle of the read
+    GIE = 0;
+    
+    // The newest queued write to the address wins
+    for (i = mQueueCount; i > 0; i--)
+    {
+        nvm_write_t* pWrite = &mQueue[(mQueueHead + i - 1) % NVM_QUEUE_LEN];
+        
+        if (pWrite->addr == addr)
+        {
+            value = pWrite->value;
+            GIE = interruptsEnabled;
+            return value;
+        }
+    }
+    
+    // Can't read while a write is still in progress. Its interrupt is taken 
+    // once interrupts are back on
+    while (NVMCON1bits.WR);
+    
+    NVMADRH = NVM_EEPROM_ADDR_HIGH;
+    NVMADRL = addr;
+    
+    NVMCON1 = 0b01000000; // NVMREGS (data EEPROM and configuration space)
+    NVMCON1bits.RD = 1;
+    value = NVMDATL;
+    
+    GIE = interruptsEnabled;
+    
+    return value;
+}
+
+// Write one byte of data EEPROM at the given offset. WARNING: Writes are very 
+// slow, about 2-3 ms per byte, and this waits for completion (and for any queued
+// writes ahead of it). Prefer NVM_queue_write()
+void NVM_write_eeprom(uint8_t addr, uint8_t value)
+{
+    NVM_flush();
+    
+    nvm_start(addr, value);
+    
+    while (NVMCON1bits.WR);
+    
+    NVMCON1bits.WREN = 0;
+}
+
+// Queue one byte to be written to data EEPROM at the given offset. The write 
+// starts from NVM_service() once there's the energy for it, and runs while the 
+// core sleeps. If the queue is full, this waits for it to drain
+void NVM_queue_write(uint8_t addr, uint8_t value)
+{
+    bool interruptsEnabled = GIE;
+    uint8_t i;
+    
+    if (mQueueCount >= NVM_QUEUE_LEN)
+    {
+        NVM_flush();
+    }
+    
+    // The NVM interrupt moves the head of the queue
+    GIE = 0;
+    
+    // Replace a waiting write to the same address, but not one in progress
+    for (i = mWriting ? 1 : 0; i < mQueueCount; i++)
+    {
+        nvm_write_t* pWrite = &mQueue[(mQueueHead + i) % NVM_QUEUE_LEN];
+        
+        if (pWrite->addr == addr)
+        {
+            pWrite->value = value;
+            GIE = interruptsEnabled;
+            return;
+        }
+    }
+    
+    i = (mQueueHead + mQueueCount) % NVM_QUEUE_LEN;
+    mQueue[i].addr = addr;
+    mQueue[i].value = value;
+    mQueueCount++;
+    
+    GIE = interruptsEnabled;
+}
+
+// Start the next queued write, if there is one and the energy allows
+void NVM_service(void)
+{
+    if (mQueueCount && !mWriting && VCC_ABOVE_MV(NVM_WRITE_MIN_MV))
+    {
+        nvm_start_queued();
+    }
+}
+
+// NVM interrupt: a queued write has finished. Go right on to the next one, if 
+// the energy allows
+void NVM_write_done(void)
+{
+    NVMIF = 0;
+    NVMIE = 0;
+    NVMCON1bits.WREN = 0;
+    
+    mQueueHead = (mQueueHead + 1) % NVM_QUEUE_LEN;
+    mQueueCount--;
+    mWriting = false;
+    
+    NVM_service();
+}
+
+// True while there are writes waiting or in progress
+bool NVM_write_pending(void)
+{
+    return mQueueCount != 0;
+}
+
+// True if a write to the address is queued but hasn't started yet, so that
+// another write to it would just replace the value
+bool NVM_write_waiting(uint8_t addr)
+{
+    bool interruptsEnabled = GIE;
+    bool waiting = false;
+    uint8_t i;
+    
+    // The NVM interrupt moves the head of the queue
+    GIE = 0;
+    
+    for (i = mWriting ? 1 : 0; i < mQueueCount; i++)
+    {
+        if (mQueue[(mQueueHead + i) % NVM_QUEUE_LEN].addr == addr)
+        {
+            waiting = true;
+            break;
+        }
+    }
+    
+    GIE = interruptsEnabled;
+    
+    return waiting;
+}
+
+// Finish all queued writes, whatever the energy. Call before a reset
+void NVM_flush(void)
+{
+    while (mQueueCount)
+    {
+        if (!mWriting)
+        {
+            nvm_start_queued();
+        }
+        
+        // With interrupts off, finish the write here instead
+        if (!GIE && !NVMCON1bits.WR)
+        {
+            NVM_write_done();
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef __NVM_H
+#define __NVM_H
+
+#include "global.h"
+
+// Data EEPROM map, as offsets into the 256-byte data EEPROM
+#define NVM_EEPROM_PREFS_ADDR       (0x00) // Preference journal (see prefs.c)
+#define NVM_EEPROM_PREFS_LEN        (0x80)
+#define NVM_EEPROM_ANIM_ADDR        (0x80) // LED animation program (see anim.h)
+#define NVM_EEPROM_ANIM_LEN         (0x40)
+#define NVM_EEPROM_PROFILE_ADDR     (0xC0) // profiler builds only
+#define NVM_EEPROM_PROFILE_LEN      (0x40)
+
+uint8_t NVM_read_eeprom(uint8_t addr);
+void NVM_write_eeprom(uint8_t addr, uint8_t value);
+void NVM_queue_write(uint8_t addr, uint8_t value);
+void NVM_service(void);
+void NVM_write_done(void);
+bool NVM_write_pending(void);
+bool NVM_write_waiting(uint8_t addr);
+void NVM_flush(void);
+
+#endif
@@ -1,28 +1,56 @@
 #include <stddef.h>
 #include "prefs.h"
 #include "global.h"
-#include "supercap.h"
+#include "nvm.h"
+#include "leds.h"
+#include "trace.h"
 
 // Macros and constants
 
 #define PREFS_MAGIC_NUMBER      0x5E
 
+// The preferences are kept as a journal of records in a ring of slots at the
+// start of the data EEPROM (see nvm.h). Each change writes a whole new record to
+// the slot after the newest one, so the writes spread over every slot, and a
+// record cut short by a brown-out fails its CRC and leaves the one before it as
+// the newest. The sequence number of each record is one more than the last; the
+// records in the ring always span fewer than 128 sequence numbers, so the newest
+// is the one furthest ahead of any other. The first record's worth of the area is
+// left to the layout before the journal (see prefs_load_legacy()), as some old
+// preferences would pass for a valid record
+#define PREFS_RECORD_LEN                (4)
+#define PREFS_JOURNAL_SLOTS             (NVM_EEPROM_PREFS_LEN / PREFS_RECORD_LEN - 1)
+#define PREFS_RECORD_ADDR(_slot)        (uint8_t)(NVM_EEPROM_PREFS_ADDR + ((_slot) + 1) * PREFS_RECORD_LEN)
+
+// CRC-8 (polynomial x^8 + x^2 + x + 1), started from all ones so that neither
+// erased nor zeroed EEPROM makes a valid record
+#define PREFS_CRC_POLY                  (0x07)
+#define PREFS_CRC_INIT                  (0xFF)
+
 typedef enum
 {
-    EEPROM_ADDR_FLAG,
-    EEPROM_ADDR_BLINK_TIME,
-    EEPROM_ADDR_SELF_TEST,
-    EEPROM_ADDR__LEN
-} eeprom_addrs_t;
+    RECORD_SEQ,
+    RECORD_BLINK_TIME,
+    RECORD_FLAGS,
+    RECORD_CRC,
+} record_bytes_t;
 
 #define EEPROM_FLAG_SUPERCAP_CHRG       0
 #define EEPROM_FLAG_TREE_STAR           1
 #define EEPROM_FLAG_HARVEST_CHRG        2
 #define EEPROM_FLAG_HARVEST_BLINK       3
 #define EEPROM_FLAG_FAST_BLINKS         4
+#define EEPROM_FLAG_SELF_TEST           5
 
-// Different byte
-#define EEPROM_FLAG_SELF_TEST           0
+// The layout before the journal: three bytes at the start of the data EEPROM,
+// each with odd parity in bit 0. Erased and zeroed bytes both fail the parity
+typedef enum
+{
+    LEGACY_ADDR_FLAG,           // EEPROM_FLAG_... (but not SELF_TEST) << 1
+    LEGACY_ADDR_BLINK_TIME,     // blinkTimeLimit << 2 | fastBlinksEn << 1
+    LEGACY_ADDR_SELF_TEST,      // selfTestEn << 1
+    LEGACY_ADDR__LEN
+} legacy_addrs_t;
 
 // Typedefs
 
@@ -40,101 +68,186 @@ const prefs_t cDefaultPrefs =
     .selfTestEn = true,
 };
 
-// The actual underlying EEPROM storage location
-__eeprom uint8_t mPrefsEepromBacking[EEPROM_ADDR__LEN];
-
 // A shadow copy of what's in the EEPROM so we can quickly tell what's changed
 static prefs_t mPrefsEepromShadow;
 
-// The globally accessible version of our preferences
+// The globally accessible version of our preferences. Until PREFS_init() runs
+// (partway through the boot), everything is off
 prefs_t gPrefsCache;
 
+// The newest record in the journal
+static uint8_t mJournalSlot = PREFS_JOURNAL_SLOTS - 1;
+static uint8_t mJournalSeq = UINT8_MAX;
+
 // Implementations
 
-// Load the cache directly from EEPROM
-static void prefs_load(void)
+// CRC of the first bytes of a record
+static uint8_t prefs_crc(const uint8_t* pRecord)
 {
-    uint8_t onesCount = 0;
+    uint8_t crc = PREFS_CRC_INIT;
+    uint8_t i;
+    uint8_t bit;
     
-    uint8_t blinkConfigRaw = mPrefsEepromBacking[EEPROM_ADDR_BLINK_TIME];
+    for (i = 0; i < RECORD_CRC; i++)
+    {
+        crc ^= pRecord[i];
+        
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ PREFS_CRC_POLY) : (uint8_t)(crc << 1);
+        }
+    }
     
-    onesCount = cSetBitsInByte[blinkConfigRaw];
+    return crc;
+}
+
+// Load the cache from the layout before the journal, field by field, using the
+// defaults for any byte that fails its parity. Returns false if every byte does,
+// i.e., if there are no old preferences
+static bool prefs_load_legacy(void)
+{
+    uint8_t raw[LEGACY_ADDR__LEN];
+    bool valid[LEGACY_ADDR__LEN];
+    uint8_t i;
     
-    // We want odd parity
-    if (onesCount & 1)
+    for (i = 0; i < LEGACY_ADDR__LEN; i++)
     {
-        // Valid parity, so load the values
-        gPrefsCache.blinkTimeLimit = blinkConfigRaw >> 2;
-        gPrefsCache.fastBlinksEn = (blinkConfigRaw >> 1) & 1;
+        raw[i] = NVM_read_eeprom(NVM_EEPROM_PREFS_ADDR + i);
+        valid[i] = cSetBitsInByte[raw[i]] & 1;
     }
-    else
+    
+    if (!valid[LEGACY_ADDR_FLAG] && !valid[LEGACY_ADDR_BLINK_TIME] && !valid[LEGACY_ADDR_SELF_TEST])
     {
-        // Invalid parity, so use defaults
-        gPrefsCache.blinkTimeLimit = cDefaultPrefs.blinkTimeLimit;
-        gPrefsCache.fastBlinksEn = cDefaultPrefs.fastBlinksEn;
+        return false;
     }
     
-    uint8_t booleanFlags = mPrefsEepromBacking[EEPROM_ADDR_FLAG];
+    gPrefsCache = cDefaultPrefs;
     
-    onesCount = cSetBitsInByte[booleanFlags];
+    if (valid[LEGACY_ADDR_FLAG])
+    {
+        gPrefsCache.harvestBlinkEn = !!(raw[LEGACY_ADDR_FLAG] & (1 << (EEPROM_FLAG_HARVEST_BLINK + 1)));
+        gPrefsCache.harvestRailChargeEn = !!(raw[LEGACY_ADDR_FLAG] & (1 << (EEPROM_FLAG_HARVEST_CHRG + 1)));
+        gPrefsCache.treeStarEn = !!(raw[LEGACY_ADDR_FLAG] & (1 << (EEPROM_FLAG_TREE_STAR + 1)));
+    }
     
-    // We want odd parity
-    if (onesCount & 1)
+    if (valid[LEGACY_ADDR_BLINK_TIME])
     {
-        // Valid parity, so load the values
-        gPrefsCache.harvestBlinkEn = !!(booleanFlags & (1 << (EEPROM_FLAG_HARVEST_BLINK + 1)));
-        gPrefsCache.harvestRailChargeEn = !!(booleanFlags & (1 << (EEPROM_FLAG_HARVEST_CHRG + 1)));
-        gPrefsCache.treeStarEn = !!(booleanFlags & (1 << (EEPROM_FLAG_TREE_STAR + 1)));
+        gPrefsCache.blinkTimeLimit = raw[LEGACY_ADDR_BLINK_TIME] >> 2;
+        gPrefsCache.fastBlinksEn = (raw[LEGACY_ADDR_BLINK_TIME] >> 1) & 1;
     }
-    else
+    
+    if (valid[LEGACY_ADDR_SELF_TEST])
     {
-        // Invalid parity, so use defaults
-        gPrefsCache.harvestBlinkEn = cDefaultPrefs.harvestBlinkEn;
-        gPrefsCache.harvestRailChargeEn = cDefaultPrefs.harvestRailChargeEn;
-        gPrefsCache.treeStarEn = cDefaultPrefs.treeStarEn;
+        gPrefsCache.selfTestEn = (raw[LEGACY_ADDR_SELF_TEST] >> 1) & 1;
     }
     
-    uint8_t selfTestFlag = mPrefsEepromBacking[EEPROM_ADDR_SELF_TEST];
+    return true;
+}
+
+// Find the newest valid record in the journal and load the cache from it, or
+// from the defaults if there isn't one (returning false). Reads every slot once,
+// so takes the same time no matter what's there
+static bool prefs_load(void)
+{
+    uint8_t record[PREFS_RECORD_LEN];
+    uint8_t newest[PREFS_RECORD_LEN];
+    bool found = false;
+    uint8_t slot;
+    uint8_t i;
     
-    onesCount = cSetBitsInByte[selfTestFlag];
+    for (slot = 0; slot < PREFS_JOURNAL_SLOTS; slot++)
+    {
+        for (i = 0; i < PREFS_RECORD_LEN; i++)
+        {
+            record[i] = NVM_read_eeprom(PREFS_RECORD_ADDR(slot) + i);
+        }
+        
+        if (record[RECORD_CRC] != prefs_crc(record))
+        {
+            continue;
+        }
+        
+        if (!found || (int8_t)(record[RECORD_SEQ] - mJournalSeq) > 0)
+        {
+            found = true;
+            mJournalSlot = slot;
+            mJournalSeq = record[RECORD_SEQ];
+            
+            for (i = 0; i < PREFS_RECORD_LEN; i++)
+            {
+                newest[i] = record[i];
+            }
+        }
+    }
     
-    // We want odd parity
-    if (onesCount & 1)
+    if (found)
     {
-        // Valid parity, so load the values
-        gPrefsCache.selfTestEn = !!(selfTestFlag & (1 << (EEPROM_FLAG_SELF_TEST + 1)));
+        uint8_t flags = newest[RECORD_FLAGS];
+        
+        gPrefsCache.blinkTimeLimit = newest[RECORD_BLINK_TIME];
+        gPrefsCache.fastBlinksEn = !!(flags & (1 << EEPROM_FLAG_FAST_BLINKS));
+        gPrefsCache.harvestBlinkEn = !!(flags & (1 << EEPROM_FLAG_HARVEST_BLINK));
+        gPrefsCache.harvestRailChargeEn = !!(flags & (1 << EEPROM_FLAG_HARVEST_CHRG));
+        gPrefsCache.treeStarEn = !!(flags & (1 << EEPROM_FLAG_TREE_STAR));
+        gPrefsCache.selfTestEn = !!(flags & (1 << EEPROM_FLAG_SELF_TEST));
     }
     else
     {
-        // Invalid parity, so use defaults
-        gPrefsCache.selfTestEn = cDefaultPrefs.selfTestEn;
+        // No valid records, so use defaults
+        gPrefsCache = cDefaultPrefs;
     }
+    
+    mPrefsEepromShadow = gPrefsCache;
+    
+    return found;
 }
 
-// Write to the PIC16's internal EEPROM the specified value at the specified address. Try 
-// to limit the writes for particular commands to a single byte
+// Queue the shadow copy as a new record in the slot after the newest one. The
+// CRC goes last, so the record isn't valid until it's all there. If the newest
+// record is still waiting in the queue with none of it written, the new one takes
+// its place instead (the queue replaces each waiting byte), so a burst of changes
+// costs one record and never fills the queue
+static void prefs_journal_write(void)
+{
+    uint8_t record[PREFS_RECORD_LEN];
+    uint8_t i;
+    
+    // Writes go in order, so the record is untouched if its first byte is still waiting
+    if (!NVM_write_waiting(PREFS_RECORD_ADDR(mJournalSlot) + RECORD_SEQ))
+    {
+        mJournalSlot = (mJournalSlot + 1) % PREFS_JOURNAL_SLOTS;
+        mJournalSeq++;
+    }
+    
+    record[RECORD_SEQ] = mJournalSeq;
+    record[RECORD_BLINK_TIME] = mPrefsEepromShadow.blinkTimeLimit;
+    record[RECORD_FLAGS] = (uint8_t)(
+            mPrefsEepromShadow.fastBlinksEn << EEPROM_FLAG_FAST_BLINKS |
+            mPrefsEepromShadow.harvestBlinkEn << EEPROM_FLAG_HARVEST_BLINK |
+            mPrefsEepromShadow.harvestRailChargeEn << EEPROM_FLAG_HARVEST_CHRG |
+            mPrefsEepromShadow.treeStarEn << EEPROM_FLAG_TREE_STAR |
+            mPrefsEepromShadow.selfTestEn << EEPROM_FLAG_SELF_TEST);
+    record[RECORD_CRC] = prefs_crc(record);
+    
+    for (i = 0; i < PREFS_RECORD_LEN; i++)
+    {
+        NVM_queue_write(PREFS_RECORD_ADDR(mJournalSlot) + i, record[i]);
+    }
+}
+
+// Apply the proposed preferences and, if they changed, queue a new journal 
+// record for writing to the PIC16's internal EEPROM (see NVM_queue_write())
 void PREFS_update(prefs_t* pProposedSettings)
 {
-    // Force supercap charging to stop temporarily, as writing EEPROM takes a
-    // while and requires a lot of power. Writing one byte takes about 3 ms.
-    SUPERCAP_force_charging_off();
+    bool changed = false;
     
-    // WARNING: Writes are very slow, about 2ms per byte!
     if (pProposedSettings->blinkTimeLimit != gPrefsCache.blinkTimeLimit ||
         pProposedSettings->fastBlinksEn != gPrefsCache.fastBlinksEn)
     {
         // No bounding checks here
         gPrefsCache.blinkTimeLimit = pProposedSettings->blinkTimeLimit;
         gPrefsCache.fastBlinksEn = pProposedSettings->fastBlinksEn;
-        
-        uint8_t writeValue = (uint8_t)(gPrefsCache.blinkTimeLimit << 1) | (gPrefsCache.fastBlinksEn & 1);
-        
-        uint8_t onesCount = cSetBitsInByte[writeValue];
-        
-        // Odd parity
-        uint8_t parity = (onesCount & 1) ? 0 : 1;
-        
-        mPrefsEepromBacking[EEPROM_ADDR_BLINK_TIME] = (uint8_t)(writeValue << 1) | (parity & 1); 
+        changed = true;
     }
     
     if (pProposedSettings->harvestBlinkEn != gPrefsCache.harvestBlinkEn ||
@@ -144,46 +257,53 @@ void PREFS_update(prefs_t* pProposedSettings)
         gPrefsCache.harvestBlinkEn = pProposedSettings->harvestBlinkEn;
         gPrefsCache.harvestRailChargeEn = pProposedSettings->harvestRailChargeEn;
         gPrefsCache.treeStarEn = pProposedSettings->treeStarEn;
+        changed = true;
         
-        uint8_t consolidatedFlags = (uint8_t)(
-                gPrefsCache.harvestBlinkEn << EEPROM_FLAG_HARVEST_BLINK |
-                gPrefsCache.harvestRailChargeEn << EEPROM_FLAG_HARVEST_CHRG |
-                gPrefsCache.treeStarEn << EEPROM_FLAG_TREE_STAR);
-        
-        // Odd parity
-        uint8_t parity = (cSetBitsInByte[consolidatedFlags] & 1) ? 0 : 1;
+        LED_prefs_changed();
+    }
+    
+    if (changed)
+    {
+        // Everything but the self-test flag, which is saved separately
+        bool savedSelfTest = mPrefsEepromShadow.selfTestEn;
+        mPrefsEepromShadow = gPrefsCache;
+        mPrefsEepromShadow.selfTestEn = savedSelfTest;
         
-        mPrefsEepromBacking[EEPROM_ADDR_FLAG] = (uint8_t)(consolidatedFlags << 1) | (parity & 1);
+        prefs_journal_write();
     }
+    
+    TRACE(TRACE_FEATURES, PREFS_FEATURE_BITS(gPrefsCache));
 }
 
+#if FEATURE_SELF_TEST
 // Enable or disable the saved self-test mode, but not the currently active one
 // (so that self-test keeps running as long as desired). In other words, DON'T
 // change gPrefsCache.selfTestEn here!
 void PREFS_self_test_saved_state(bool enable)
 {
-    static uint8_t sLastTempSetState = UINT8_MAX;
-    
-    // Workaround since we can't initialize with a non-const value
-    if (sLastTempSetState == UINT8_MAX)
-    {
-        sLastTempSetState = gPrefsCache.selfTestEn;
-    }
-    
     // Don't write the self-test flag repeatedly; once is enough
-    if (enable != sLastTempSetState)
+    if (enable != mPrefsEepromShadow.selfTestEn)
     {
-        // Odd parity
-        uint8_t parity = !enable; // in this case (with a bool), it's trivial
-                
-        mPrefsEepromBacking[EEPROM_ADDR_SELF_TEST] = (uint8_t)(enable << 1) | (parity & 1);
-        sLastTempSetState = enable;
+        mPrefsEepromShadow.selfTestEn = enable;
+        prefs_journal_write();
     }
 }
+#endif
 
-// Read the preferences out of EEPROM, and initialize if needed
-// Takes about 115 us when Fosc=16MHz, so long as no write is needed
+// Read the preferences out of the EEPROM journal, or out of the layout before it
+// if it's empty, or use the defaults if that's empty too. Takes a couple of 
+// milliseconds when Fosc=16MHz, mostly the CRCs
 void PREFS_init(void)
 {
-    prefs_load();
+    if (!prefs_load() && prefs_load_legacy())
+    {
+        // Carry the old preferences over into the journal, once. The old bytes 
+        // stay, to migrate again if the record doesn't make it
+        mPrefsEepromShadow = gPrefsCache;
+        prefs_journal_write();
+    }
+    
+    LED_prefs_changed();
+    
+    TRACE(TRACE_FEATURES, PREFS_FEATURE_BITS(gPrefsCache));
 }
@@ -17,10 +17,19 @@ typedef struct
 
 
 
+// Enabled features as a bitmask, for tracing
+#define PREFS_FEATURE_BITS(_prefs)  (uint8_t)((_prefs).treeStarEn << 0 | \
+                                              (_prefs).harvestRailChargeEn << 1 | \
+                                              (_prefs).harvestBlinkEn << 2 | \
+                                              (_prefs).fastBlinksEn << 3 | \
+                                              (_prefs).selfTestEn << 4)
+
 extern prefs_t gPrefsCache;
 
 void PREFS_update(prefs_t* pProposedSettings);
+#if FEATURE_SELF_TEST
 void PREFS_self_test_saved_state(bool enable);
+#endif
 void PREFS_init(void);
 
 #endif
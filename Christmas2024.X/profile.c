@@ -0,0 +1,153 @@
+#include "profile.h"
+#include "global.h"
+#include "nvm.h"
+
+#ifdef ENABLE_PROFILER
+
+// Macros and constants
+
+// Flush to EEPROM about every five minutes. The flush writes at most one
+// (changed) byte per tick, since each write takes a few milliseconds
+#define PROFILE_FLUSH_EVERY_TICKS   (300 * TICKS_PER_SEC)
+
+// Typedefs
+
+typedef struct
+{
+    uint16_t    count;
+    uint16_t    min;
+    uint16_t    max;
+    uint32_t    sum;
+} profile_record_t;
+
+// Variables
+
+static uint16_t mStartCycles[PROF__NUM];
+
+static profile_record_t mRecords[PROF__NUM];
+
+static uint8_t mMilestoneTicks[PROFILE_MILESTONES];
+
+// Byte offset of the flush in progress, or zero if not flushing
+static uint8_t mFlushOffset = 0;
+
+// Implementations
+
+// Read the free-running cycle counter. Reading the low byte latches the high byte
+static uint16_t profile_now(void)
+{
+    uint8_t low = TMR1L;
+    
+    return (uint16_t)(TMR1H << 8) | low;
+}
+
+// Byte of the EEPROM image at the given offset (after the magic byte)
+static uint8_t profile_image_byte(uint8_t offset)
+{
+    if (offset >= PROF__NUM * sizeof(profile_record_t))
+    {
+        return mMilestoneTicks[offset - PROF__NUM * sizeof(profile_record_t)];
+    }
+    
+    uint8_t recordIndex = offset / sizeof(profile_record_t);
+    uint8_t byteIndex = offset % sizeof(profile_record_t);
+    const profile_record_t* pRecord = &mRecords[recordIndex];
+    
+    // Spell out the layout rather than relying on struct packing
+    switch (byteIndex)
+    {
+        case 0: return (uint8_t)(pRecord->count);
+        case 1: return (uint8_t)(pRecord->count >> 8);
+        case 2: return (uint8_t)(pRecord->min);
+        case 3: return (uint8_t)(pRecord->min >> 8);
+        case 4: return (uint8_t)(pRecord->max);
+        case 5: return (uint8_t)(pRecord->max >> 8);
+        case 6: return (uint8_t)(pRecord->sum);
+        case 7: return (uint8_t)(pRecord->sum >> 8);
+        case 8: return (uint8_t)(pRecord->sum >> 16);
+        default: return (uint8_t)(pRecord->sum >> 24);
+    }
+}
+
+void PROFILE_init(void)
+{
+    // Timer1 -- Free-running instruction cycle counter
+    PMD1bits.TMR1MD = 0;
+    T1CLK = 0b0001; // Fosc/4
+    T1CON = 0b00000011; // 1:1 prescaler, synchronized, 16-bit reads, on
+    
+    for (uint8_t i = 0; i < PROF__NUM; i++)
+    {
+        mRecords[i].min = UINT16_MAX;
+    }
+}
+
+void PROFILE_start(profile_id_t id)
+{
+    mStartCycles[id] = profile_now();
+}
+
+// Spans longer than 65535 cycles (about 16 ms at 16 MHz) wrap around
+void PROFILE_stop(profile_id_t id)
+{
+    uint16_t cycles = profile_now() - mStartCycles[id];
+    profile_record_t* pRecord = &mRecords[id];
+    
+    // Hold the counters still while they're being written out
+    if (mFlushOffset)
+    {
+        return;
+    }
+    
+    // Saturate rather than wrap, so the average stays meaningful
+    if (pRecord->count < UINT16_MAX)
+    {
+        pRecord->count++;
+        pRecord->sum += cycles;
+    }
+    
+    pRecord->min = MIN(pRecord->min, cycles);
+    pRecord->max = MAX(pRecord->max, cycles);
+}
+
+// Note the tick at which a milestone was reached
+void PROFILE_milestone(uint8_t index, uint32_t tick)
+{
+    mMilestoneTicks[index] = (uint8_t)MIN(tick, UINT8_MAX);
+}
+
+// Call once per tick. Writes at most one changed byte of the counters to EEPROM
+void PROFILE_flush(void)
+{
+    if (gTickCount % PROFILE_FLUSH_EVERY_TICKS == 0 && gTickCount != 0)
+    {
+        if (NVM_read_eeprom(NVM_EEPROM_PROFILE_ADDR) != PROFILE_EEPROM_MAGIC)
+        {
+            NVM_write_eeprom(NVM_EEPROM_PROFILE_ADDR, PROFILE_EEPROM_MAGIC);
+        }
+        
+        mFlushOffset = 1;
+    }
+    
+    while (mFlushOffset)
+    {
+        uint8_t offset = mFlushOffset - 1;
+        uint8_t addr = NVM_EEPROM_PROFILE_ADDR + mFlushOffset;
+        uint8_t value = profile_image_byte(offset);
+        
+        mFlushOffset++;
+        if (mFlushOffset > PROF__NUM * sizeof(profile_record_t) + PROFILE_MILESTONES)
+        {
+            mFlushOffset = 0;
+        }
+        
+        // Skip over unchanged bytes to save both time and wear
+        if (NVM_read_eeprom(addr) != value)
+        {
+            NVM_write_eeprom(addr, value);
+            break;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "global.h"
+
+// On-target cycle profiler. Build with ENABLE_PROFILER defined to count the 
+// instruction cycles (Fosc/4, on Timer1) spent in the hot functions and to flush
+// the counters to data EEPROM every few minutes, where a programmer can read
+// them back. Otherwise, the hooks compile to nothing.
+//
+// EEPROM layout, starting at NVM_EEPROM_PROFILE_ADDR: one PROFILE_EEPROM_MAGIC
+// byte, then one record per profile_id_t, each with little-endian fields:
+// uint16 count, uint16 min, uint16 max, uint32 sum (all in instruction cycles),
+// then one byte per boot milestone (boot_stage_t in main.c): the tick at which
+// it was reached, saturating at 255
+
+#define PROFILE_EEPROM_MAGIC    (0xC5)
+#define PROFILE_MILESTONES      (3) // BOOT__NUM in main.c
+
+typedef enum
+{
+    PROF_SYSTEM_TICK,
+    PROF_ADC_READ_VCC,
+    PROF_RF_SAMPLE_BIT,
+    PROF_RF_FRAME_DECODE,
+    PROF_LED_TWINKLE,
+    PROF_SUPERCAP_CHARGE,
+    PROF__NUM
+} profile_id_t;
+
+#ifdef ENABLE_PROFILER
+
+#define PROFILE_START(_id)      PROFILE_start(_id)
+#define PROFILE_STOP(_id)       PROFILE_stop(_id)
+#define PROFILE_MILESTONE(_index, _tick)    PROFILE_milestone(_index, _tick)
+
+void PROFILE_init(void);
+void PROFILE_start(profile_id_t id);
+void PROFILE_stop(profile_id_t id);
+void PROFILE_milestone(uint8_t index, uint32_t tick);
+void PROFILE_flush(void);
+
+#else
+
+#define PROFILE_START(_id)
+#define PROFILE_STOP(_id)
+#define PROFILE_MILESTONE(_index, _tick)
+
+#define PROFILE_init()
+#define PROFILE_flush()
+
+#endif
+
+#endif
@@ -4,6 +4,9 @@
 #include "leds.h"
 #include "adc.h"
 #include "prefs.h"
+#include "profile.h"
+#include "trace.h"
+#include "nvm.h"
 
 // Macros and constants
 
@@ -162,19 +165,23 @@ static bool rf_command_handler(uint8_t decodedWord)
             // If we get two unlock commands in a row, interpret that as a reset
             if (mCommandUnlocked)
             {
+                NVM_flush();
                 RESET();
                 // never returns;
             }
             break;
+#if FEATURE_SELF_TEST
         case CMD_SELF_TEST:
             // Start a self-test by rebooting into self-test mode
             if (mCommandUnlocked)
             {
                 PREFS_self_test_saved_state(true);
+                NVM_flush();
                 RESET();
                 // NOTE: does not return
             }
             break;            
+#endif
         default:
             commandSuccess = false;
             break;
@@ -263,6 +270,8 @@ static bool rf_frame_decode(uint64_t frameBits)
         cmdSuccess = rf_command_handler(codewordWithHighestCorr);
     }
     
+    TRACE(TRACE_RF_DECODE_END, cmdSuccess ? codewordWithHighestCorr : 0xFF);
+    
     return cmdSuccess;
 }
 
@@ -343,7 +352,12 @@ void RF_sample_bit(void)
     // microseconds even at Fosc = 16 MHz)
     if (barkerCorr > BARKER_CORR_THRESH)
     {
-        if (rf_frame_decode(mBitCache))
+        TRACE(TRACE_RF_DECODE_BEGIN, barkerCorr);
+        PROFILE_START(PROF_RF_FRAME_DECODE);
+        bool decoded = rf_frame_decode(mBitCache);
+        PROFILE_STOP(PROF_RF_FRAME_DECODE);
+        
+        if (decoded)
         {
             LED_blink_ack();
         }        
@@ -374,6 +388,8 @@ uint8_t RF_update_slicer_level(void)
         }
     }  
     
+    TRACE(TRACE_RF_LEVEL, mRfLevelPeak);
+    
     return mRfLevelPeak;
 }
 
@@ -6,6 +6,13 @@
 // Don't bother looking for RF traffic if the RF level isn't very high to begin with
 #define RF_LEVEL_MIN_FOR_COMMS_COUNTS       (32)
 
+// Cycle costs and deadlines, used to pick the clock speed for each task.
+// Bit sampling includes the occasional frame decode
+#define RF_UPDATE_SLICER_CYCLES             (500) // about 120 us at 16 MHz, mostly the ADC read
+#define RF_UPDATE_SLICER_DEADLINE_US        (1000)
+#define RF_SAMPLE_BIT_CYCLES                (1800) // about 450 us at 16 MHz when a frame is decoded
+#define RF_SAMPLE_BIT_DEADLINE_US           (2000)
+
 
 void RF_sample_bit(void);
 uint8_t RF_update_slicer_level(void);
@@ -5,6 +5,8 @@
 #include "supercap.h"
 #include "adc.h"
 
+#if FEATURE_SELF_TEST
+
 // Macros and constants
 
 #define VCC_USB_LDO_MIN_MV              (3100) // Can droop this low when charging a fully discharged supercap, especially on first boot
@@ -44,8 +46,8 @@ void SELF_TEST_state_machine_update(void)
             // consistently via USB: look for the expected voltage after one
             // diode drop, and look for it to be relatively stable (to eliminate
             // confusion with, e.g., an RF source)
-            if (gVcc > VCC_USB_LDO_MIN_MV &&
-                gVcc < VCC_USB_LDO_MAX_MV)
+            if (VCC_ABOVE_MV(VCC_USB_LDO_MIN_MV) &&
+                VCC_BELOW_MV(VCC_USB_LDO_MAX_MV))
             {
                 if (mTicksInCurrentState > VCC_USB_LDO_STABLE_TICKS)
                 {
@@ -150,3 +152,5 @@ self_test_step_t SELF_TEST_get_current_step(void)
 {
     return mSelfTestState;
 }
+
+#endif
@@ -2,9 +2,14 @@
 #define __SELF_TEST_H
 
 #include "global.h"
+#include "prefs.h"
 
 #define SELF_TEST_TIMEOUT_TICKS  (TICKS_PER_SEC * 30)
 
+// Cycle cost and deadline of the state machine update, used to pick the clock speed for it
+#define SELF_TEST_UPDATE_CYCLES         (200)
+#define SELF_TEST_UPDATE_DEADLINE_US    (1000)
+
 typedef enum
 {
     STS_USB_LDO,
@@ -14,7 +19,21 @@ typedef enum
     STS__NUM
 } self_test_step_t;
 
+#if FEATURE_SELF_TEST
+
+// Whether the self-test is running (as it does from the first boot until it passes)
+#define SELF_TEST_ACTIVE()      (gPrefsCache.selfTestEn)
+
 self_test_step_t SELF_TEST_get_current_step(void);
 void SELF_TEST_state_machine_update(void);
 
+#else
+
+// Field images never run the self-test, so every check of it compiles away
+#define SELF_TEST_ACTIVE()      (false)
+
+#define SELF_TEST_state_machine_update()
+
+#endif
+
 #endif
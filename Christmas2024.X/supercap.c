@@ -2,39 +2,76 @@
 #include "global.h"
 #include "adc.h"
 #include "prefs.h"
+#include "rf.h"
+#include "trace.h"
+#include "nvm.h"
+#include "self_test.h"
+#include "leds.h"
 
 // Macros and constants
 
-// The minimum forward drop of the schottky diode during charging
-// (This is actually the value at about 4 uA of charging current)
-#define DIODE_DROP_MIN                              (200)
-
-// Max charge of the supercap without damage
-#define SUPERCAP_MAX_MV                             (3300)
-
 // This constant converts the difference between Vcc and the supercap 
 // damage threshold (including diode drop) in millivolts into a number
 // of counts that can be directly compared to the 8-bit measurement of
 // the supercap charge-monitor pin, most accurately valid at Vcc=3600 mV
 // (for Vcc=3300 mV, this value shoudl be closer to 12, but since we only
-// care about it when Vcc >= 3500 mV, this approximation is good enoguh)
+// care about it when Vcc >= 3500 mV, this approximation is good enoguh).
+// The division is done as a multiply by the Q10 reciprocal and a shift
 #define MV_TO_COUNTS_FOR_RELATIVE_SUPERCAP          (14)
+#define MV_TO_COUNTS_FOR_RELATIVE_SUPERCAP_RECIP_Q10    (1024 / MV_TO_COUNTS_FOR_RELATIVE_SUPERCAP)
 
 // Supercap charging action thresholds [mV]
-#define SUPERCAP_CHRG_THRESH_OFF_TO_SLOW_MIN        (2700)
-
-#define SUPERCAP_CHRG_THRESH_SLOW_TO_OFF_UNDER      (2500)
-#define SUPERCAP_CHRG_THRESH_SLOW_TO_OFF_OVER       (SUPERCAP_MAX_MV + DIODE_DROP_MIN)
-#define SUPERCAP_CHRG_THRESH_SLOW_TO_FAST           (2950)
+#define SUPERCAP_CHRG_THRESH_OFF_TO_REGULATED_MIN   VCC_LEVEL_MV(SUPERCAP_CHRG_LEVEL_ON)
 
+#define SUPERCAP_CHRG_THRESH_REGULATED_TO_OFF_UNDER VCC_LEVEL_MV(SUPERCAP_CHRG_LEVEL_OFF)
+#define SUPERCAP_CHRG_THRESH_REGULATED_TO_OFF_OVER  (SUPERCAP_MAX_MV + DIODE_DROP_MIN)
 
 #define SUPERCAP_CHRG_THRESH_FAST_TO_OFF_OVER       (SUPERCAP_MAX_MV + DIODE_DROP_MIN)
-#define SUPERCAP_CHRG_THRESH_FAST_TO_OFF_UNDER      (2500)
-#define SUPERCAP_CHRG_THRESH_FAST_TO_SLOW           (2700)
+#define SUPERCAP_CHRG_THRESH_FAST_TO_OFF_UNDER      VCC_LEVEL_MV(SUPERCAP_CHRG_LEVEL_OFF)
 
 #define TICKS_BOOTUP_TO_OFF                         (2 * TICKS_PER_SEC) // Should be longer than the LED-only run time 
-#define TICKS_STABLE_FOR_OFF_TO_SLOW                (TICKS_PER_SEC/2)
-#define TICKS_STABLE_FOR_SLOW_TO_FAST               (4 * TICKS_PER_SEC) // should be longer than one RF packet
+#define TICKS_STABLE_FOR_OFF_TO_REGULATED           (TICKS_PER_SEC/2)
+
+// Regulated charging: PWM6 drives the charge pin push-pull through the 3.3k, off 
+// the shared, free-running Timer2 on the LFINTOSC (so it keeps going while the
+// core sleeps). Its period is about 1 ms, with a 7-bit duty cycle. The duty cycle is
+// integrated from the error between Vcc and the setpoint, in ADC counts, on each
+// tick with a fresh Vcc measurement (watching the setpoint keeps them frequent):
+// with more voltage than the harvester needs, charge harder. Regulation starts 
+// again from the last duty cycle that held the setpoint, but never from below
+// CHRG_PWM_DUTY_START_MIN, so that the cap charges from the moment it's on. A step
+// of CHRG_PWM_DUTY_LOAD_STEP or more changes the load too much for the Vcc trend
+#define CHRG_PWM_DUTY_MAX                           TIMER2_PWM_DUTY_MAX
+#define CHRG_PWM_DUTY_START_MIN                     (CHRG_PWM_DUTY_MAX / 8)
+#define CHRG_PWM_DUTY_LOAD_STEP                     (CHRG_PWM_DUTY_MAX / 8)
+#define CHRG_PWM_PPS                                (0x0E) // PWM6OUT
+#define CHRG_SETPOINT_COUNTS                        (SUPERCAP_CHRG_LEVEL_SETPOINT * 8)
+
+// Maximum power point tracking (perturb and observe). The charge current (duty 
+// cycle times the drop across the 3.3k) is averaged over a window, then the 
+// setpoint takes a step; if the average fell since the last window, the steps turn
+// around. Only ticks with a real Vcc measurement (which watching the setpoint
+// keeps frequent) are sampled, since gVccCounts is just the trend's estimate in
+// between. The supercap side of the drop is still the model's. The setpoint stays between the overcharge check and the charging cut-off, and each
+// harvest source keeps its own. The setpoint holds still while the LED stoker
+// measures its own effect on the harvest
+#define MPPT_WINDOW_TICKS                           (2 * TICKS_PER_SEC)
+#define MPPT_STEP_COUNTS                            (1)
+#define MPPT_SETPOINT_MIN_COUNTS                    ADC_MV_TO_VCC_COUNTS(3300)
+#define MPPT_SETPOINT_MAX_COUNTS                    ADC_MV_TO_VCC_COUNTS(2600)
+
+// Energy model currents [uA]. The push-pull drive charges through the 3.3k 
+// resistor, for the PWM duty cycle's share of the time when regulated. Leakage 
+// climbs steeply above about 3.0 V. When not charging and the supercap (less a 
+// diode drop) is above Vcc, it's assumed to be carrying the card's average load
+#define MODEL_STEP_TICKS                            (TICKS_PER_SEC)
+#define MODEL_MS_PER_TICK                           (1000 / TICKS_PER_SEC)
+#define MODEL_FAST_CHARGE_OHMS                      (3300)
+#define MODEL_LEAKAGE_HIGH_MV                       (3000)
+#define MODEL_LEAKAGE_HIGH_UA                       (20)
+#define MODEL_LEAKAGE_LOW_UA                        (2)
+#define MODEL_LOAD_UA                               (30)
+#define MODEL_MAX_UV                                (SUPERCAP_MAX_MV * 1000UL)
 
 
 // Typedefs
@@ -43,11 +80,18 @@ typedef enum
 {
     CAP_STATE_BOOTUP,
     CAP_STATE_CHARGING_OFF,
-    CAP_STATE_CHARGING_SLOWLY,
+    CAP_STATE_CHARGING_REGULATED,
     CAP_STATE_CHARGING_QUICKLY,
     CAP_STATE__NUM_STATES,
 } cap_charging_state_t;
 
+typedef enum
+{
+    HARVEST_AMBIENT,    // Light, or RF too weak for comms
+    HARVEST_PHONE,      // RF strong enough for comms
+    HARVEST__NUM_SOURCES,
+} harvest_source_t;
+
 // Variables
 static cap_charging_state_t mCapStateMachineState = CAP_STATE_BOOTUP;
 
@@ -55,27 +99,139 @@ static uint32_t mTicksAtStateEntry = 0;
 
 static bool mIsCharging = false;
 
-static bool mForceChargingStop = false;
+// True once the self-test has had its quick charge
+static bool mSelfTestQuickCharged = false;
 
 static uint8_t mLastCountsDown = 0;
 
+static uint8_t mChargeDuty = 0; // Out of CHRG_PWM_DUTY_MAX
+static uint8_t mConvergedDuty = CHRG_PWM_DUTY_START_MIN;
+
+static harvest_source_t mHarvestSource = HARVEST_AMBIENT;
+static uint8_t mSetpointCounts[HARVEST__NUM_SOURCES] = { CHRG_SETPOINT_COUNTS, CHRG_SETPOINT_COUNTS };
+static int8_t mMpptStep = -MPPT_STEP_COUNTS; // Start out climbing in voltage
+static uint8_t mMpptTicks = 0;
+static uint32_t mMpptSum = 0;
+static uint32_t mMpptLastSum = 0;
+static uint8_t mMpptSamples = 0;
+static uint8_t mMpptLastSamples = 0;
+
+// Modeled supercap voltage. Assume it's empty until the first relative reading says otherwise
+static uint32_t mCapUv = 0;
+static uint16_t mCapMv = 0; // The same, to the nearest millivolt, for per-tick use
+static uint32_t mModelTick = 0;
+
 // Implementations
 
+// Set the modeled voltage from a burst-averaged relative reading, which is the
+// drop from Vcc to the supercap plus a diode, in 4096ths of Vcc
+static void supercap_anchor(uint16_t countsDownX16)
+{
+    uint16_t vccMv = ADC_counts_to_mv(gVccCounts);
+    uint16_t dropMv = (uint16_t)(((uint32_t)vccMv * countsDownX16) >> 12) + DIODE_DROP_MIN;
+    
+    mCapUv = (vccMv > dropMv) ? (uint32_t)(vccMv - dropMv) * 1000 : 0;
+    mCapUv = MIN(mCapUv, MODEL_MAX_UV);
+    mCapMv = (uint16_t)(mCapUv / 1000);
+}
+
+// Integrate the modeled net current into the supercap since the last step, using
+// the charging state that has been in effect over that time
+static void supercap_model_step(void)
+{
+    uint16_t elapsedMs = (uint16_t)MIN(gTickCount - mModelTick, MODEL_STEP_TICKS * 4) * MODEL_MS_PER_TICK;
+    uint16_t vccMv = ADC_counts_to_mv(gVccCounts);
+    uint16_t capMv = mCapMv;
+    uint16_t capPlusDiodeMv = capMv + DIODE_DROP_MIN;
+    int16_t currentUa = 0;
+    int32_t deltaUv = 0;
+    
+    mModelTick = gTickCount;
+    
+    switch (mCapStateMachineState)
+    {
+        case CAP_STATE_CHARGING_REGULATED:
+            if (vccMv > capPlusDiodeMv)
+            {
+                currentUa = (int16_t)(((uint32_t)(vccMv - capPlusDiodeMv) * 1000 * mChargeDuty) / (MODEL_FAST_CHARGE_OHMS * CHRG_PWM_DUTY_MAX));
+            }
+            break;
+        case CAP_STATE_CHARGING_QUICKLY:
+            if (vccMv > capPlusDiodeMv)
+            {
+                currentUa = (int16_t)(((uint32_t)(vccMv - capPlusDiodeMv) * 1000) / MODEL_FAST_CHARGE_OHMS);
+            }
+            break;
+        default:
+            if (capMv > vccMv + DIODE_DROP_MIN)
+            {
+                currentUa = -MODEL_LOAD_UA;
+            }
+            break;
+    }
+    
+    currentUa -= (capMv > MODEL_LEAKAGE_HIGH_MV) ? MODEL_LEAKAGE_HIGH_UA : MODEL_LEAKAGE_LOW_UA;
+    
+    deltaUv = (int32_t)currentUa * elapsedMs / SUPERCAP_CAPACITANCE_MF;
+    
+    if (deltaUv < 0 && (uint32_t)-deltaUv > mCapUv)
+    {
+        mCapUv = 0;
+    }
+    else
+    {
+        mCapUv = MIN((uint32_t)((int32_t)mCapUv + deltaUv), MODEL_MAX_UV);
+    }
+    
+    mCapMv = (uint16_t)(mCapUv / 1000);
+}
+
+// Take a burst-averaged relative reading of the supercap. The burst is long
+// enough to average over many PWM periods, mixing the low phases into the reading
+// in proportion to the duty cycle, so while regulating the charge pin is held high
+// for it (as when charging quickly), and handed back to PWM6 after
+static uint16_t supercap_read_relative_x16(void)
+{
+    uint16_t countsDownX16;
+    
+    if (mCapStateMachineState != CAP_STATE_CHARGING_REGULATED)
+    {
+        return ADC_read_supercap_relative_x16();
+    }
+    
+    LATC = LATC | SUPERCAP_MED_CHRG_PIN;
+    RC7PPS = 0x00; // LATC
+    
+    countsDownX16 = ADC_read_supercap_relative_x16();
+    
+    RC7PPS = CHRG_PWM_PPS;
+    LATC = (LATC & ~(SUPERCAP_MED_CHRG_PIN));
+    
+    return countsDownX16;
+}
+
 // Check if we're in danger of overcharging the cap
 static bool supercap_charge_too_high(void)
 {
     bool tooHigh = false;
 
-    if (gVcc > (SUPERCAP_MAX_MV + DIODE_DROP_MIN))
+    if (VCC_ABOVE_MV(SUPERCAP_MAX_MV + DIODE_DROP_MIN))
     {
         // We have a high voltage, and we're currently charging, so check
         // that we're not overcharging the cap (i.e., exceeding 3300 mV)        
         
-        mLastCountsDown = ADC_read_supercap_relative();
+        // Compare in sixteenths of a count, using the burst-averaged reading,
+        // rather than in whole counts that are about as big as the noise
+        uint16_t countsDownX16 = supercap_read_relative_x16();
+        mLastCountsDown = (uint8_t)(countsDownX16 >> 4);
+        TRACE(TRACE_SUPERCAP_DELTA, mLastCountsDown);
+        supercap_anchor(countsDownX16);
     
-        uint8_t threshold = (uint8_t)((gVcc - (SUPERCAP_MAX_MV + DIODE_DROP_MIN)) / MV_TO_COUNTS_FOR_RELATIVE_SUPERCAP);
+        // This is one of the few places that needs actual millivolts
+        uint16_t mv = MAX(ADC_counts_to_mv(gVccCounts), SUPERCAP_MAX_MV + DIODE_DROP_MIN);
+        uint16_t thresholdX16 = (uint16_t)((mv - (SUPERCAP_MAX_MV + DIODE_DROP_MIN)) * MV_TO_COUNTS_FOR_RELATIVE_SUPERCAP_RECIP_Q10) >> 6;
 
-        if (mLastCountsDown <= threshold)
+        if (countsDownX16 <= thresholdX16)
         {
             // Voltage is too high (implying cap is already pretty highly charged anyway)
             tooHigh = true;
@@ -85,11 +241,153 @@ static bool supercap_charge_too_high(void)
     return tooHigh;
 }
 
-// Force supercap charging to stop temporarily
-void SUPERCAP_force_charging_off(void)
+// Set the charge duty cycle
+static void supercap_pwm_duty(uint8_t duty)
+{
+    mChargeDuty = duty;
+    
+    // The upper 8 of the 10 duty cycle bits go in PWM6DCH
+    PWM6DCH = mChargeDuty >> 2;
+    PWM6DCL = (uint8_t)(mChargeDuty << 6);
+}
+
+// Start the power point tracker's window over, with nothing to compare against
+static void supercap_mppt_restart(void)
 {
-    mForceChargingStop = true;
-    SUPERCAP_charge();
+    mMpptTicks = 0;
+    mMpptSum = 0;
+    mMpptSamples = 0;
+    mMpptLastSum = 0;
+    mMpptLastSamples = 0;
+}
+
+// Hand the charge pin to PWM6, starting from the last duty cycle that held the setpoint
+static void supercap_pwm_start(void)
+{
+    TIMER2_use(TIMER2_USER_CHARGER, true);
+    PMD3bits.PWM6MD = 0;
+    
+    CCPTMRS1bits.P6TSEL = 0b01; // PWM6 off Timer2
+    
+    supercap_pwm_duty(MAX(mConvergedDuty, CHRG_PWM_DUTY_START_MIN));
+    PWM6CON = 0b10000000; // Enabled, active high
+    
+    LATC = (LATC & ~(SUPERCAP_MED_CHRG_PIN));
+    RC7PPS = CHRG_PWM_PPS;
+    WPUC7 = 0;
+    TRISCbits.TRISC7 = 0;
+    
+    supercap_mppt_restart();
+    VCC_watch_setpoint(mSetpointCounts[mHarvestSource]);
+}
+
+// Take the charge pin back from PWM6 and power the PWM (and, if the LEDs aren't
+// using it, Timer2) back down
+static void supercap_pwm_stop(void)
+{
+    RC7PPS = 0x00; // Back to LATC
+    mChargeDuty = 0;
+    VCC_watch_setpoint(VCC_SETPOINT_NONE);
+    
+    PWM6CON = 0b00000000;
+    
+    PMD3bits.PWM6MD = 1;
+    TIMER2_use(TIMER2_USER_CHARGER, false);
+}
+
+// Nudge the duty cycle by the error between Vcc and the setpoint. Vcc counts fall
+// as Vcc rises, so a positive error means that there's voltage to spare. Only a
+// real measurement counts; between them, gVccCounts is just the trend's estimate
+static void supercap_regulate(void)
+{
+    int16_t error = (int16_t)mSetpointCounts[mHarvestSource] - (int16_t)gVccCounts;
+    int16_t duty = (int16_t)mChargeDuty + error;
+    
+    if (!VCC_measured_this_tick())
+    {
+        return;
+    }
+    
+    if (error >= -1 && error <= 1)
+    {
+        mConvergedDuty = mChargeDuty;
+    }
+    
+    duty = MAX(duty, 0);
+    duty = MIN(duty, CHRG_PWM_DUTY_MAX);
+    
+    if (duty >= (int16_t)mChargeDuty + CHRG_PWM_DUTY_LOAD_STEP ||
+        duty <= (int16_t)mChargeDuty - CHRG_PWM_DUTY_LOAD_STEP)
+    {
+        VCC_load_changed();
+    }
+    
+    supercap_pwm_duty((uint8_t)duty);
+}
+
+// Perturb and observe: average the charge current over a window, then step the
+// setpoint, turning the steps around whenever the last one made things worse
+static void supercap_track_mpp(void)
+{
+    harvest_source_t source = (RF_get_latest_slicer_level() >= RF_LEVEL_MIN_FOR_COMMS_COUNTS) ? HARVEST_PHONE : HARVEST_AMBIENT;
+    uint16_t vccMv = ADC_counts_to_mv(gVccCounts);
+    uint16_t capPlusDiodeMv = mCapMv + DIODE_DROP_MIN;
+    int16_t setpoint = 0;
+    
+    if (source != mHarvestSource)
+    {
+        // Pick up where this source left off, with a fresh window
+        mHarvestSource = source;
+        supercap_mppt_restart();
+        VCC_watch_setpoint(mSetpointCounts[source]);
+        return;
+    }
+    
+    if (LED_stoker_measuring())
+    {
+        // Start over afterward, since the stoker may have moved in the meantime
+        supercap_mppt_restart();
+        return;
+    }
+    
+    if (VCC_measured_this_tick())
+    {
+        if (vccMv > capPlusDiodeMv)
+        {
+            mMpptSum += (uint32_t)mChargeDuty * (vccMv - capPlusDiodeMv);
+        }
+        mMpptSamples++;
+    }
+    
+    // Keep the window open until it has at least one measurement
+    if (++mMpptTicks < MPPT_WINDOW_TICKS || !mMpptSamples)
+    {
+        return;
+    }
+    
+    // Compare the averages (sum over samples) without dividing. The sums are under
+    // 2^25 and there are at most a window's worth of samples, so nothing overflows
+    if (mMpptSum * mMpptLastSamples < mMpptLastSum * mMpptSamples)
+    {
+        mMpptStep = -mMpptStep;
+    }
+    
+    mMpptLastSum = mMpptSum;
+    mMpptLastSamples = mMpptSamples;
+    mMpptSum = 0;
+    mMpptSamples = 0;
+    mMpptTicks = 0;
+    
+    // Turn around at the ends of the range, too
+    setpoint = (int16_t)mSetpointCounts[source] + mMpptStep;
+    if (setpoint < MPPT_SETPOINT_MIN_COUNTS || setpoint > MPPT_SETPOINT_MAX_COUNTS)
+    {
+        mMpptStep = -mMpptStep;
+        setpoint = (int16_t)mSetpointCounts[source] + mMpptStep;
+    }
+    
+    mSetpointCounts[source] = (uint8_t)setpoint;
+    VCC_watch_setpoint((uint8_t)setpoint);
 }
 
 // Update the state machine. Returns true if charging in any way, false otherwise
@@ -99,6 +397,11 @@ bool SUPERCAP_charge(void)
     bool isCharging = mIsCharging;
     cap_charging_state_t newState = mCapStateMachineState;
     
+    if (SUPERCAP_model_step_due())
+    {
+        supercap_model_step();
+    }
+    
     // Action based on the current state, including updates to the state
     switch (mCapStateMachineState)
     {
@@ -107,18 +410,26 @@ bool SUPERCAP_charge(void)
             {
                 newState = CAP_STATE_CHARGING_OFF;
             }
-            else if (gPrefsCache.selfTestEn)
+            else if (SELF_TEST_ACTIVE())
             {
                 newState = CAP_STATE_CHARGING_QUICKLY;
             }
             break;
         case CAP_STATE_CHARGING_OFF:
-            if (gVcc > SUPERCAP_CHRG_THRESH_OFF_TO_SLOW_MIN)
+            // On a weak supply, the preferences (and so the self-test) may only be
+            // loaded after the bootup state has ended. Give the self-test its quick 
+            // charge then instead
+            if (SELF_TEST_ACTIVE() && !mSelfTestQuickCharged)
+            {
+                newState = CAP_STATE_CHARGING_QUICKLY;
+            }
+            // Charging waits for any EEPROM writes, which take a lot of power
+            else if (VCC_ABOVE_MV(SUPERCAP_CHRG_THRESH_OFF_TO_REGULATED_MIN) && !NVM_write_pending())
             {
                 // Have we had a stable voltage long enough to justify starting charging?
-                if (sTicksVoltageGoodForUpshift > TICKS_STABLE_FOR_OFF_TO_SLOW)
+                if (sTicksVoltageGoodForUpshift > TICKS_STABLE_FOR_OFF_TO_REGULATED)
                 {
-                    newState = CAP_STATE_CHARGING_SLOWLY;
+                    newState = CAP_STATE_CHARGING_REGULATED;
                     sTicksVoltageGoodForUpshift = 0;
                 }
                 else
@@ -132,54 +443,46 @@ bool SUPERCAP_charge(void)
                 sTicksVoltageGoodForUpshift = 0;
             }
             break;
-        case CAP_STATE_CHARGING_SLOWLY:
-            if (gVcc < SUPERCAP_CHRG_THRESH_SLOW_TO_OFF_UNDER ||
-                mForceChargingStop ||
+        case CAP_STATE_CHARGING_REGULATED:
+            if (VCC_BELOW_MV(SUPERCAP_CHRG_THRESH_REGULATED_TO_OFF_UNDER) ||
+                NVM_write_pending() ||
                 supercap_charge_too_high())
             {
                 newState = CAP_STATE_CHARGING_OFF;
             }
-            else if (gVcc > SUPERCAP_CHRG_THRESH_SLOW_TO_FAST)   
-            {
-                if (sTicksVoltageGoodForUpshift > TICKS_STABLE_FOR_SLOW_TO_FAST)
-                {
-                    newState = CAP_STATE_CHARGING_QUICKLY;
-                    sTicksVoltageGoodForUpshift = 0;
-                }
-                else
-                {
-                    sTicksVoltageGoodForUpshift++;
-                }
-            }
             else
             {
-                sTicksVoltageGoodForUpshift = 0;
+                supercap_regulate();
+                supercap_track_mpp();
             }
             break;
         case CAP_STATE_CHARGING_QUICKLY:
             // Don't allow us to leave the quick-charging state if we're in self-test mode unless we're
             // going to overcharge the cap or we're trying to get out of the mode
-            if (gPrefsCache.selfTestEn)
+            if (SELF_TEST_ACTIVE())
             {
                 // Force an update to allow us to check for charging success in self-test mode
-                mLastCountsDown = ADC_read_supercap_relative();
+                uint16_t countsDownX16 = supercap_read_relative_x16();
+                mLastCountsDown = (uint8_t)(countsDownX16 >> 4);
+                supercap_anchor(countsDownX16);
                 
-                if (supercap_charge_too_high() || mForceChargingStop)
+                if (supercap_charge_too_high() || NVM_write_pending())
                 {
                     newState = CAP_STATE_CHARGING_OFF;
                 }
             }
             else
             {
-                if (gVcc < SUPERCAP_CHRG_THRESH_FAST_TO_OFF_UNDER ||
-                    mForceChargingStop ||
+                // Out of self-test, so hand over to the regulator
+                if (VCC_BELOW_MV(SUPERCAP_CHRG_THRESH_FAST_TO_OFF_UNDER) ||
+                    NVM_write_pending() ||
                     supercap_charge_too_high())
                 {
                     newState = CAP_STATE_CHARGING_OFF;
                 }
-                else if (gVcc < SUPERCAP_CHRG_THRESH_FAST_TO_SLOW)
+                else
                 {
-                    newState = CAP_STATE_CHARGING_SLOWLY;
+                    newState = CAP_STATE_CHARGING_REGULATED;
                 }
             }
             break;
@@ -190,6 +493,14 @@ bool SUPERCAP_charge(void)
     // Action based on the new state
     if (newState != mCapStateMachineState)
     {
+        // Account for the time spent in the old state before leaving it
+        supercap_model_step();
+        
+        if (mCapStateMachineState == CAP_STATE_CHARGING_REGULATED)
+        {
+            supercap_pwm_stop();
+        }
+        
         switch (newState)
         {
             case CAP_STATE_BOOTUP:
@@ -200,11 +511,9 @@ bool SUPERCAP_charge(void)
                 TRISCbits.TRISC7 = 1;
                 WPUC7 = 0;
                 break;
-            case CAP_STATE_CHARGING_SLOWLY:
-                // Slow-charge cap (weak pull-up)
-                LATC = (LATC & ~(SUPERCAP_MED_CHRG_PIN));
-                TRISCbits.TRISC7 = 1;
-                WPUC7 = 1;
+            case CAP_STATE_CHARGING_REGULATED:
+                // Charge cap at a regulated fraction of the push-pull rate
+                supercap_pwm_start();
                 isCharging = true;
                 break;
             case CAP_STATE_CHARGING_QUICKLY:
@@ -213,21 +522,22 @@ bool SUPERCAP_charge(void)
                 TRISCbits.TRISC7 = 0;
                 WPUC7 = 0;
                 isCharging = true;
+                mSelfTestQuickCharged = true;
                 break;
             default:
                 break;
         }
         
+        TRACE(TRACE_SUPERCAP_STATE, newState);
+        
         mTicksAtStateEntry = gTickCount;
         mCapStateMachineState = newState;
     }
     
-    mIsCharging = (mCapStateMachineState == CAP_STATE_CHARGING_SLOWLY ||
+    mIsCharging = (mCapStateMachineState == CAP_STATE_CHARGING_REGULATED ||
                    mCapStateMachineState == CAP_STATE_CHARGING_QUICKLY);
 
 //    DEBUG_VALUE(isCharging);
-        
-    mForceChargingStop = false;
                 
     return mIsCharging;
 }
@@ -251,4 +561,38 @@ uint8_t SUPERCAP_get_latest_voltage_delta(void)
         return 0;
     }
 }
-        
\ No newline at end of file
+
+// True if the next SUPERCAP_charge() steps the energy model, which takes much
+// longer than the rest of it
+bool SUPERCAP_model_step_due(void)
+{
+    return gTickCount - mModelTick >= MODEL_STEP_TICKS;
+}
+
+// Returns the regulated charging duty cycle (out of TIMER2_PWM_DUTY_MAX), or 0 when
+// charging isn't regulated
+uint8_t SUPERCAP_get_charge_duty(void)
+{
+    return mChargeDuty;
+}
+
+// Returns the modeled supercap voltage in millivolts. Unlike the voltage delta,
+// this is available whether or not the supercap is charging
+uint16_t SUPERCAP_get_voltage_mv(void)
+{
+    return (uint16_t)(mCapUv / 1000);
+}
+
+// Returns the modeled energy left in the supercap above SUPERCAP_EMPTY_MV, in 
+// microjoules: C * (V^2 - Vempty^2) / 2, with C in mF and V in mV, is in nJ
+uint32_t SUPERCAP_get_energy_uj(void)
+{
+    uint32_t mv = SUPERCAP_get_voltage_mv();
+    
+    if (mv <= SUPERCAP_EMPTY_MV)
+    {
+        return 0;
+    }
+    
+    return (mv * mv - (uint32_t)SUPERCAP_EMPTY_MV * SUPERCAP_EMPTY_MV) / 2000 * SUPERCAP_CAPACITANCE_MF;
+}
@@ -2,9 +2,48 @@
 #define __SUPERCAP_H
 
 #include "global.h"
+#include "vcc.h"
+
+// Supercap charging action thresholds, as supply guard levels (see vcc.h) so that
+// they can be watched without full measurements. While charging, the charge current
+// is regulated to hold Vcc at the setpoint
+#define SUPERCAP_CHRG_LEVEL_OFF         (13) // 2520 mV
+#define SUPERCAP_CHRG_LEVEL_ON          (12) // 2730 mV
+#define SUPERCAP_CHRG_LEVEL_SETPOINT    (11) // 2978 mV
+
+// The minimum forward drop of the schottky diode during charging
+// (This is actually the value at about 4 uA of charging current)
+#define DIODE_DROP_MIN                  (200)
+
+// Max charge of the supercap without damage
+#define SUPERCAP_MAX_MV                 (3300)
+
+// Energy model. The supercap voltage is tracked by integrating the modeled charge
+// current (less leakage and load) over time, and re-anchored to the relative ADC 
+// reading whenever there is one. Dividing microamps times milliseconds by 
+// millifarads gives microvolts directly
+#define SUPERCAP_CAPACITANCE_MF         (100)
+#define SUPERCAP_EMPTY_MV               (2000) // Too low to keep the card running through the diode
+
+// Cycle cost and deadline of SUPERCAP_charge(), used to pick the clock speed for it.
+// Includes the overcharge check with its relative ADC read and divide, and the
+// power point tracker's sum
+#define SUPERCAP_CHARGE_CYCLES          (800)
+#define SUPERCAP_CHARGE_DEADLINE_US     (500)
+
+// Extra cycles on the ticks that step the energy model (once a second), and the
+// looser deadline for them. The step is several 32-bit multiplies and divides of a
+// few hundred cycles each (estimated from the library routines; profile with
+// ENABLE_PROFILER to check). State changes also step the model, but rarely enough
+// to ride on the normal budget
+#define SUPERCAP_MODEL_STEP_CYCLES      (3200)
+#define SUPERCAP_MODEL_DEADLINE_US      (2000)
 
 bool SUPERCAP_charge(void);
-void SUPERCAP_force_charging_off(void);
+bool SUPERCAP_model_step_due(void);
 uint8_t SUPERCAP_get_latest_voltage_delta(void);
+uint8_t SUPERCAP_get_charge_duty(void);
+uint16_t SUPERCAP_get_voltage_mv(void);
+uint32_t SUPERCAP_get_energy_uj(void);
 
 #endif
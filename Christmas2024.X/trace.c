@@ -0,0 +1,83 @@
+#include "trace.h"
+#include "global.h"
+
+#ifdef ENABLE_TRACE
+
+// Macros and constants
+
+// Extra high time for a 1 bit. The loop overhead makes up the rest of each bit
+// period (about 15 cycles), so this makes a 1 roughly three times as long as a 0
+#define TRACE_ONE_EXTRA_CYCLES  (8)
+
+// Low time after each frame, well over the length of any low time within a frame
+#define TRACE_GAP_CYCLES        (100)
+
+#define TRACE_SYNC_BITS         (0b10)
+
+// Events held back while the clock is at CLK_SLOW (the LFINTOSC, NOSC 0b101),
+// where a frame would take about 100 ms. Any more than this are dropped
+#define TRACE_NOSC_LFINTOSC     (0b101)
+#define TRACE_DEFERRED_MAX      (4)
+
+// Typedefs
+
+// Variables
+
+static uint16_t mDeferredFrames[TRACE_DEFERRED_MAX];
+static uint8_t mDeferredCount = 0;
+
+// Implementations
+
+// Send one frame on DEBUG_PIN. Interrupts must be held off, so that an ISR can't
+// stretch a pulse or a gap
+static void trace_send(uint16_t frame)
+{
+    for (uint8_t i = 0; i < TRACE_FRAME_BITS; i++)
+    {
+        DEBUG_SET();
+        
+        if (frame & (1u << (TRACE_FRAME_BITS - 1)))
+        {
+            _delay(TRACE_ONE_EXTRA_CYCLES);
+        }
+        
+        DEBUG_CLEAR();
+        
+        frame <<= 1;
+    }
+    
+    // Keep back-to-back frames apart
+    _delay(TRACE_GAP_CYCLES);
+}
+
+void TRACE_event(trace_id_t id, uint8_t value)
+{
+    uint16_t frame = (uint16_t)(TRACE_SYNC_BITS << 12) | (uint16_t)((id & 0x0F) << 8) | value;
+    bool interruptsEnabled = GIE;
+    
+    GIE = 0;
+    
+    if (OSCCON1bits.NOSC == TRACE_NOSC_LFINTOSC)
+    {
+        // Send it at the next faster clock instead, a little late
+        if (mDeferredCount < TRACE_DEFERRED_MAX)
+        {
+            mDeferredFrames[mDeferredCount] = frame;
+            mDeferredCount++;
+        }
+    }
+    else
+    {
+        for (uint8_t i = 0; i < mDeferredCount; i++)
+        {
+            trace_send(mDeferredFrames[i]);
+        }
+        mDeferredCount = 0;
+        
+        trace_send(frame);
+    }
+    
+    GIE = interruptsEnabled;
+}
+
+#endif
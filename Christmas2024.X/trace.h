@@ -0,0 +1,63 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "global.h"
+
+// Event trace on DEBUG_PIN, for logic-analyzer captures. Build with ENABLE_TRACE
+// defined to emit a short pulse train at each TRACE() point; otherwise, the
+// hooks compile to nothing. Decode captures with web/trace_decode.py.
+//
+// Each event is a frame of TRACE_FRAME_BITS high pulses, sent MSB-first: the sync
+// bits 1 then 0, a 4-bit event ID, and an 8-bit value. A 1 is a long high pulse
+// and a 0 is a short one, so the decoder only compares pulse widths within a
+// frame (using the sync bits as references) and doesn't care what Fosc is.
+// Interrupts are held off during a frame, and frames are separated by a low gap
+// of many bit periods. The event time is the frame's first rising edge.
+//
+// The event IDs are enough to follow the firmware's power states (task, clock,
+// BOR, pending timer callback, enabled features), so a trace captured alongside
+// a current probe can be used to split up the charge. See web/charge_attribution.py
+//
+// A frame costs about TRACE_EVENT_CYCLES instruction cycles, which stretches
+// everything around it. Keep that in mind at the slower task clocks. At CLK_SLOW
+// a frame would take about 100 ms and swallow the next tick, so events there are
+// held back and sent (late) at the next faster clock
+
+#define TRACE_FRAME_BITS        (14)
+#define TRACE_EVENT_CYCLES      (400)
+
+// Event IDs (4 bits). Keep web/trace_decode.py in sync
+typedef enum
+{
+    TRACE_TICK_BEGIN,           // value: low byte of gTickCount
+    TRACE_TICK_END,             // value: low byte of gTickCount
+    TRACE_ADC_BEGIN,            // value: ADC channel (ADPCH)
+    TRACE_ADC_END,              // value: result (ADRESH)
+    TRACE_VCC,                  // value: gVccCounts (262144 / mV)
+    TRACE_RF_LEVEL,             // value: slicer peak level
+    TRACE_RF_DECODE_BEGIN,      // value: Barker correlation
+    TRACE_RF_DECODE_END,        // value: accepted codeword, or 0xFF if none
+    TRACE_SUPERCAP_STATE,       // value: new cap_charging_state_t
+    TRACE_SUPERCAP_DELTA,       // value: counts down from Vdd to the supercap
+    TRACE_TASK,                 // value: task_t about to run
+    TRACE_CLOCK,                // value: new clock_speed_t
+    TRACE_BOR,                  // value: 1 if BOR detection is now enabled, 0 if not
+    TRACE_TIMER_SET,            // value: TIMER_once() delay in quarter milliseconds
+    TRACE_TIMER_FIRE,           // value: always 0
+    TRACE_FEATURES,             // value: PREFS_FEATURE_BITS() of gPrefsCache
+    TRACE__NUM
+} trace_id_t;
+
+#ifdef ENABLE_TRACE
+
+#define TRACE(_id, _value)      TRACE_event(_id, (uint8_t)(_value))
+
+void TRACE_event(trace_id_t id, uint8_t value);
+
+#else
+
+#define TRACE(_id, _value)
+
+#endif
+
+#endif
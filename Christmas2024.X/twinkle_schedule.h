@@ -0,0 +1,52 @@
+// Generated by web/gen_twinkle_schedule.py. Edit the generator, not this file
+#ifndef __TWINKLE_SCHEDULE_H
+#define __TWINKLE_SCHEDULE_H
+
+#include "global.h"
+
+#define TWINKLE_SCHEDULE_LENGTH     (16)
+#define TWINKLE_SCHEDULE_COMBOS     (8)
+
+// Index of the schedule for a set of preferences
+#define TWINKLE_SCHEDULE_INDEX(_prefs)  (uint8_t)((_prefs).treeStarEn << 0 | \
+                                                (_prefs).harvestRailChargeEn << 1 | \
+                                                (_prefs).harvestBlinkEn << 2)
+
+// Pin (offset from RA0PPS) and brightness level of a cTwinklePins entry
+#define TWINKLE_PIN_INDEX(_entry)   (uint8_t)((_entry) & 0x1F)
+#define TWINKLE_PIN_LEVEL(_entry)   (uint8_t)((_entry) >> 5)
+
+typedef enum
+{
+    TWINKLE_IDLE,
+    TWINKLE_PULSE,
+    TWINKLE_PULSE_HARVEST,
+    TWINKLE_STOKE,
+} twinkle_action_t;
+
+// Pin of each step, as its offset from RA0PPS (port * 8 + pin), with its brightness level
+static const uint8_t cTwinklePins[TWINKLE_SCHEDULE_LENGTH] =
+{
+    0x09, 0x0C, 0x02, 0x00, 0x08, 0x04, 0x10, 0x0D, 0x0B, 0x05, 0x0C, 0x0A, 0x07, 0x11, 0x13, 0x0C,
+};
+
+// Pin mask of each step within its port
+static const uint8_t cTwinkleMasks[TWINKLE_SCHEDULE_LENGTH] =
+{
+    0x02, 0x10, 0x04, 0x00, 0x01, 0x10, 0x01, 0x20, 0x08, 0x20, 0x10, 0x04, 0x80, 0x02, 0x08, 0x10,
+};
+
+// Action (twinkle_action_t) of each step, for each combination of preferences
+static const uint8_t cTwinkleActions[TWINKLE_SCHEDULE_COMBOS][TWINKLE_SCHEDULE_LENGTH] =
+{
+    { 1, 0, 1, 0, 1, 1, 0, 1, 1, 1, 0, 1, 1, 0, 0, 0 }, // treeStarEn=0, harvestRailChargeEn=0, harvestBlinkEn=0
+    { 1, 1, 1, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 0, 0, 1 }, // treeStarEn=1, harvestRailChargeEn=0, harvestBlinkEn=0
+    { 1, 0, 1, 0, 1, 1, 0, 1, 1, 1, 0, 1, 1, 0, 3, 0 }, // treeStarEn=0, harvestRailChargeEn=1, harvestBlinkEn=0
+    { 1, 1, 1, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 0, 3, 1 }, // treeStarEn=1, harvestRailChargeEn=1, harvestBlinkEn=0
+    { 1, 0, 1, 0, 1, 1, 2, 1, 1, 1, 0, 1, 1, 2, 2, 0 }, // treeStarEn=0, harvestRailChargeEn=0, harvestBlinkEn=1
+    { 1, 1, 1, 0, 1, 1, 2, 1, 1, 1, 1, 1, 1, 2, 2, 1 }, // treeStarEn=1, harvestRailChargeEn=0, harvestBlinkEn=1
+    { 1, 0, 1, 0, 1, 1, 2, 1, 1, 1, 0, 1, 1, 2, 3, 0 }, // treeStarEn=0, harvestRailChargeEn=1, harvestBlinkEn=1
+    { 1, 1, 1, 0, 1, 1, 2, 1, 1, 1, 1, 1, 1, 2, 3, 1 }, // treeStarEn=1, harvestRailChargeEn=1, harvestBlinkEn=1
+};
+
+#endif
@@ -0,0 +1,306 @@
+#include "vcc.h"
+#include "global.h"
+#include "adc.h"
+#include "leds.h"
+#include "supercap.h"
+
+// Macros and constants
+
+// Above this level (3276 mV), Vcc may be near the 3500 mV at which the supercap
+// overcharge check kicks in, and that check needs a fresh measurement every time
+#define VCC_LEVEL_FULL_READS_ABOVE  (10)
+
+#define VCC_LEVEL_NONE              (0)
+
+// Smoothing of the slope estimate, as a shift (i.e., each new measurement moves it half of the way)
+#define VCC_SLOPE_SMOOTHING_LOG2    (1)
+
+// Drift assumed in the absence of a trend, in Q8 counts per tick (1/64 count)
+#define VCC_MIN_DRIFT_Q8            (4)
+
+// Largest change between measurements taken as a trend, in counts. This also
+// keeps the Q8 arithmetic within 16 bits
+#define VCC_MAX_TREND_CHANGE        (63)
+
+#define VCC_NO_MEASUREMENT          (UINT8_MAX)
+
+// A setpoint is watched as the edges of a band this many counts either side of it,
+// so that Vcc sitting right on it doesn't call for a measurement on every tick
+#define VCC_SETPOINT_BAND_COUNTS    (2)
+
+// Typedefs
+
+// Variables
+
+// The levels bounding the windows within which nothing cares how Vcc moves, in 
+// increasing level (decreasing voltage) order
+static const uint8_t cGuardLevels[] = 
+{
+    VCC_LEVEL_FULL_READS_ABOVE,
+    SUPERCAP_CHRG_LEVEL_SETPOINT,
+    SUPERCAP_CHRG_LEVEL_ON,
+    SUPERCAP_CHRG_LEVEL_OFF,
+    LED_BLINK_LOW_LEVEL,
+};
+
+// Every threshold that anything compares gVccCounts against, in counts, in
+// increasing order. The trend must not carry Vcc across one of these unmeasured
+static const uint8_t cThresholdCounts[] = 
+{
+    ADC_MV_TO_VCC_COUNTS(SUPERCAP_MAX_MV + DIODE_DROP_MIN),
+    VCC_LEVEL_FULL_READS_ABOVE * 8,
+    SUPERCAP_CHRG_LEVEL_SETPOINT * 8,
+    SUPERCAP_CHRG_LEVEL_ON * 8,
+    SUPERCAP_CHRG_LEVEL_OFF * 8,
+    LED_BLINK_LOW_LEVEL * 8,
+    ADC_MV_TO_VCC_COUNTS(LED_HARVEST_STOKER_THRESH_LOW_MV),
+};
+
+// Trend of the measurements, in Q8 counts
+static uint16_t mEstimateQ8 = UINT16_MAX;
+static int16_t mSlopeQ8 = 0; // per tick, positive when Vcc is falling
+
+static uint8_t mLastMeasured = VCC_NO_MEASUREMENT;
+static uint8_t mSetpointCounts = VCC_SETPOINT_NONE;
+static uint8_t mIntervalLog2 = 0;
+static uint8_t mTicksSinceMeasured = 0;
+
+// The guard pair: the level just above the last measurement (which trips if 
+// its compare goes high) and the one just below it (which trips if its compare 
+// goes low). VCC_LEVEL_NONE if there is no such level
+static uint8_t mGuardLevelAbove = VCC_LEVEL_NONE;
+static uint8_t mGuardLevelBelow = VCC_LEVEL_NONE;
+
+// Implementations
+
+// Compare Vcc against a DAC level. Returns true if Vcc is above the level's voltage.
+// The DAC, comparator and FVR must already be set up
+static bool vcc_compare(uint8_t level)
+{
+    DAC1CON1 = level;
+    
+    // Allow the DAC to settle (see rf_read_comparator())
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        NOP();
+    }
+    
+    return MC1OUT;
+}
+
+// Pick the guard pair for a fresh measurement in counts
+static void vcc_arm_guard(uint8_t counts)
+{
+    mGuardLevelAbove = VCC_LEVEL_NONE;
+    mGuardLevelBelow = VCC_LEVEL_NONE;
+    
+    for (uint8_t i = 0; i < sizeof(cGuardLevels); i++)
+    {
+        uint8_t level = cGuardLevels[i];
+        
+        if (level * 8 <= counts)
+        {
+            mGuardLevelAbove = level;
+        }
+        else
+        {
+            mGuardLevelBelow = level;
+            break;
+        }
+    }
+}
+
+// Pick the longest power-of-two interval over which the trend moves Vcc no more
+// than half of the way to the nearest threshold in its direction of travel. A
+// minimum drift in either direction keeps the interval short near a threshold
+// even when there's no trend to speak of
+static uint8_t vcc_interval_log2(uint8_t counts)
+{
+    uint16_t distanceUpQ8 = UINT16_MAX; // to the next threshold up in counts (down in voltage)
+    uint16_t distanceDownQ8 = UINT16_MAX;
+    uint16_t distanceQ8 = 0;
+    uint16_t stepQ8 = 0;
+    uint8_t intervalLog2 = 0;
+    
+    for (uint8_t i = 0; i < sizeof(cThresholdCounts); i++)
+    {
+        uint8_t threshold = cThresholdCounts[i];
+        
+        if (threshold > counts)
+        {
+            distanceUpQ8 = (uint16_t)(threshold - counts) << 8;
+            break;
+        }
+        
+        distanceDownQ8 = (uint16_t)(counts - threshold) << 8;
+    }
+    
+    // A setpoint moves around, so it can't go in the table
+    if (mSetpointCounts != VCC_SETPOINT_NONE)
+    {
+        uint8_t bandUp = mSetpointCounts + VCC_SETPOINT_BAND_COUNTS;
+        uint8_t bandDown = mSetpointCounts - VCC_SETPOINT_BAND_COUNTS;
+        
+        if (bandUp > counts)
+        {
+            distanceUpQ8 = MIN(distanceUpQ8, (uint16_t)(bandUp - counts) << 8);
+        }
+        
+        if (bandDown < counts)
+        {
+            distanceDownQ8 = MIN(distanceDownQ8, (uint16_t)(counts - bandDown) << 8);
+        }
+    }
+    
+    if (mSlopeQ8 >= 0)
+    {
+        distanceQ8 = distanceUpQ8;
+        stepQ8 = (uint16_t)mSlopeQ8;
+    }
+    else
+    {
+        distanceQ8 = distanceDownQ8;
+        stepQ8 = (uint16_t)-mSlopeQ8;
+    }
+    
+    stepQ8 = MAX(stepQ8, VCC_MIN_DRIFT_Q8);
+    distanceQ8 = MIN(distanceQ8, MIN(distanceUpQ8, distanceDownQ8) << 2);
+    
+    // Double the interval for as long as the move over twice the interval still fits
+    while (intervalLog2 < VCC_MAX_INTERVAL_LOG2 &&
+           ((uint32_t)stepQ8 << (intervalLog2 + 2)) <= distanceQ8)
+    {
+        intervalLog2++;
+    }
+    
+    return intervalLog2;
+}
+
+// Call once per tick. Moves gVccCounts along the trend and returns true if it's time
+// for a measurement
+bool VCC_measurement_due(void)
+{
+    uint16_t previousQ8 = mEstimateQ8;
+    
+    mEstimateQ8 += (uint16_t)mSlopeQ8;
+    
+    // Don't let the trend wrap around
+    if (mSlopeQ8 > 0 && mEstimateQ8 < previousQ8)
+    {
+        mEstimateQ8 = UINT16_MAX;
+    }
+    else if (mSlopeQ8 < 0 && mEstimateQ8 > previousQ8)
+    {
+        mEstimateQ8 = 0;
+    }
+    
+    gVccCounts = (uint8_t)(mEstimateQ8 >> 8);
+    
+    mTicksSinceMeasured++;
+    
+    return (mTicksSinceMeasured >= (1 << mIntervalLog2));
+}
+
+// Take a full measurement into the trend, and schedule the next one
+void VCC_measured(uint8_t counts)
+{
+    if (mLastMeasured != VCC_NO_MEASUREMENT)
+    {
+        int16_t change = (int16_t)counts - mLastMeasured;
+        uint8_t elapsedLog2 = 0;
+        
+        // Big jumps are load changes rather than trends
+        change = MIN(change, VCC_MAX_TREND_CHANGE);
+        change = MAX(change, -VCC_MAX_TREND_CHANGE);
+        
+        // Divide by the elapsed ticks with a shift. A measurement taken early
+        // (when the guard trips) is divided by the largest power of two not over
+        // the elapsed ticks, which overstates the slope and so errs toward
+        // measuring sooner
+        while ((mTicksSinceMeasured >> (elapsedLog2 + 1)) != 0)
+        {
+            elapsedLog2++;
+        }
+        
+        int16_t slopeQ8 = (int16_t)(change * 256) >> elapsedLog2;
+        
+        mSlopeQ8 += (slopeQ8 - mSlopeQ8) >> VCC_SLOPE_SMOOTHING_LOG2;
+    }
+    
+    mLastMeasured = counts;
+    
+    // Center within the count, so that truncating the estimate rounds it
+    mEstimateQ8 = ((uint16_t)counts << 8) | (1 << 7);
+    gVccCounts = counts;
+    
+    mTicksSinceMeasured = 0;
+    mIntervalLog2 = vcc_interval_log2(counts);
+    
+    vcc_arm_guard(counts);
+}
+
+// True if gVccCounts is a full measurement taken on this tick, rather than the
+// trend's estimate
+bool VCC_measured_this_tick(void)
+{
+    return (mTicksSinceMeasured == 0);
+}
+
+// The load (e.g., supercap charging) has changed, so the trend no longer applies.
+// Measure again on the next tick, and start the trend over from there
+void VCC_load_changed(void)
+{
+    mSlopeQ8 = 0;
+    mIntervalLog2 = 0;
+    mLastMeasured = VCC_NO_MEASUREMENT;
+}
+
+// Check whether Vcc may have left the window of the last measurement, in which
+// case a full measurement is needed. Takes a couple dozen microseconds, mostly
+// waiting for the FVR
+bool VCC_guard_tripped(void)
+{
+    bool tripped = false;
+    
+    // Without a level above, Vcc is high enough that every measurement matters
+    if (mGuardLevelAbove == VCC_LEVEL_NONE)
+    {
+        return true;
+    }
+    
+    // FVR buffer 2 at 1024 mV for the comparator
+    FVRCON = 0b10000100;
+    
+    // DAC from Vdd to Vss
+    DAC1CON0 = 0b10000000;
+    
+    // Compare the FVR on the inverting input against the DAC on the non-inverting input
+    CM1NSEL = 0b0110;
+    CM1PSEL = 0b0101;
+    CM1CON0 = 0b10000000;
+    
+    while (!FVRRDY);
+    
+    if (vcc_compare(mGuardLevelAbove))
+    {
+        tripped = true;
+    }
+    else if (mGuardLevelBelow != VCC_LEVEL_NONE &&
+             !vcc_compare(mGuardLevelBelow))
+    {
+        tripped = true;
+    }
+    
+    CM1CON0 = 0;
+    DAC1CON0 = 0;
+    FVRCON = 0b00000000;
+    
+    return tripped;
+}
+
+// Have the measurement schedule watch a setpoint (in counts) that something is
+// regulating Vcc to, or stop watching it with VCC_SETPOINT_NONE
+void VCC_watch_setpoint(uint8_t counts)
+{
+    mSetpointCounts = counts;
+}
@@ -0,0 +1,31 @@
+#ifndef __VCC_H
+#define __VCC_H
+
+#include "global.h"
+
+// Supply guard. The DAC (referenced to Vdd) is compared against the 1024 mV FVR,
+// so DAC level k trips when Vdd rises above 32768 / k mV, which is exactly 8 * k 
+// ADC counts (see ADC_MV_TO_VCC_COUNTS). The Vcc thresholds that matter while 
+// charging sit on these levels so that a 1-bit compare can stand in for a full 
+// measurement until one of them may have been crossed
+#define VCC_LEVEL_MV(_level)        (32768u / (_level))
+
+// Vcc is measured at power-of-two intervals of 1 to 2^VCC_MAX_INTERVAL_LOG2 ticks,
+// depending on how soon the trend (slope) of the measurements could carry it to 
+// a threshold. Between measurements, gVccCounts follows the trend
+#define VCC_MAX_INTERVAL_LOG2       (6) // 64 ticks, or 3.2 s
+
+#define VCC_SETPOINT_NONE           (0)
+
+// Cycle cost and deadline of VCC_guard_tripped(), used to pick the clock speed for
+// it (it shares TASK_VCC with the full measurement)
+#define VCC_GUARD_CYCLES            (120)
+
+bool VCC_measurement_due(void);
+void VCC_measured(uint8_t counts);
+bool VCC_measured_this_tick(void);
+void VCC_load_changed(void);
+bool VCC_guard_tripped(void);
+void VCC_watch_setpoint(uint8_t counts);
+
+#endif
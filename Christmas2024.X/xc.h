@@ -0,0 +1,32 @@
+#ifndef XC_STUB
+#define XC_STUB
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#define __interrupt(...) 
+#define __eeprom
+#define NOP() ((void)0)
+#define SLEEP() ((void)0)
+#define CLRWDT() ((void)0)
+#define RESET() ((void)0)
+#define di() ((void)0)
+#define ei() ((void)0)
+#define _delay(x) ((void)0)
+extern volatile struct { unsigned ANSB5:8; } ANSELBbits;
+extern volatile struct { unsigned C1TSEL:8; } CCPTMRS0bits;
+extern volatile struct { unsigned P6TSEL:8; unsigned P7TSEL:8; } CCPTMRS1bits;
+extern volatile struct { unsigned CLKREN:8; } CLKRCONbits;
+extern volatile struct { unsigned IDLEN:8; } CPUDOZEbits;
+extern volatile struct { unsigned RD:8; unsigned WR:8; unsigned WREN:8; } NVMCON1bits;
+extern volatile struct { unsigned NOSC:8; } OSCCON1bits;
+extern volatile struct { unsigned TMR1MD:8; unsigned TMR2MD:8; unsigned TMR3MD:8; unsigned TMR4MD:8; } PMD1bits;
+extern volatile struct { unsigned CCP1MD:8; unsigned PWM6MD:8; unsigned PWM7MD:8; } PMD3bits;
+extern volatile struct { unsigned CLC1MD:8; } PMD5bits;
+extern volatile struct { unsigned T0OUTPS:8; } T0CON0bits;
+extern volatile struct { unsigned T0CKPS:8; unsigned T0CS:8; } T0CON1bits;
+extern volatile struct { unsigned ON:8; } T4CONbits;
+extern volatile struct { unsigned CKPS:8; } T6CONbits;
+extern volatile struct { unsigned TRISB5:8; } TRISBbits;
+extern volatile struct { unsigned TRISC7:8; } TRISCbits;
+extern volatile struct { unsigned SWDTEN:8; } WDTCON0bits;
+#endif
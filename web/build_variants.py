@@ -0,0 +1,144 @@
+"""
+Builds the firmware's image variants and reports how they differ.
+
+The factory image is the one the MPLAB project builds as-is. It includes the
+self-test that every card runs on its first boot. The field image is built with
+FIELD_IMAGE defined (see FEATURE_SELF_TEST in global.h). It leaves out the
+self-test state machine, its LED sequence and RF command, and every check of the
+self-test preference on the tick. Load the field image onto cards that have
+already passed their self-test.
+
+Each variant is a clean build of the "default" configuration. The variant's
+defines go in through MP_EXTRA_CC_PRE, the hook the generated makefiles leave for
+extra compiler options. The hex, map and memory summary of each variant are
+copied to dist/variants/<variant>/ in the project. Then the flash and RAM used by
+each variant are printed side by side.
+
+Cycle counts can't be worked out on the host. For them, build with --profile,
+which adds ENABLE_PROFILER to every variant. Run each image on a card for a few
+minutes, read the data EEPROM back as Intel HEX (as for profile_decode.py), and
+pass the dumps with --dumps in the same order as the variants. The average and
+worst-case cycles per tick are then compared too.
+
+Usage: python build_variants.py [--profile] [--make MAKE] [--dumps FACTORY.hex FIELD.hex]
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import xml.etree.ElementTree as ET
+
+import profile_decode
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+PROJECT_DIR = os.path.normpath(os.path.join(HERE, "..", "Christmas2024.X"))
+CONF = "default"
+DIST_DIR = os.path.join(PROJECT_DIR, "dist", CONF, "production")
+IMAGE_NAME = "Christmas2024.X.production"
+OUTPUT_DIR = os.path.join(PROJECT_DIR, "dist", "variants")
+
+# Variant name and the defines that make it, factory first
+VARIANTS = [
+    ("factory", []),
+    ("field", ["FIELD_IMAGE"]),
+]
+
+# Profiled functions to compare, as named by profile_decode.py
+CYCLE_ROWS = ["system_tick", "LED_twinkle", "SUPERCAP_charge"]
+
+
+def build(make, defines):
+    """A clean build of the project with the given defines"""
+    extra = " ".join("-D%s" % d for d in defines)
+    common = [make, "-C", PROJECT_DIR, "CONF=%s" % CONF]
+    subprocess.run(common + ["clean"], check=True)
+    subprocess.run(common + ["build", "MP_EXTRA_CC_PRE=%s" % extra], check=True)
+
+
+def collect(name):
+    """Copy the build's outputs aside, and return the path of its memory summary"""
+    out = os.path.join(OUTPUT_DIR, name)
+    os.makedirs(out, exist_ok=True)
+    for src in (IMAGE_NAME + ".hex", IMAGE_NAME + ".map", "memoryfile.xml"):
+        shutil.copy(os.path.join(DIST_DIR, src), os.path.join(out, src))
+    return os.path.join(out, "memoryfile.xml")
+
+
+def memory_used(path):
+    """Used space of each memory in the linker's memory summary, as {name: (used, units)}"""
+    used = {}
+    for elem in ET.parse(path).iter():
+        # Ignore any namespace on the tags
+        if elem.tag.split("}")[-1] != "memory":
+            continue
+        fields = {child.tag.split("}")[-1]: (child.text or "").strip() for child in elem}
+        used[elem.get("name")] = (int(fields.get("used", "0"), 0), fields.get("units", ""))
+    return used
+
+
+def tick_cycles(path):
+    """Average and worst-case cycles of the profiled functions in an EEPROM dump"""
+    eeprom = profile_decode.read_eeprom(path)
+    if eeprom[profile_decode.PROFILE_ADDR] != profile_decode.PROFILE_MAGIC:
+        raise ValueError("%s has no profiler data" % path)
+    cycles = {}
+    offset = profile_decode.PROFILE_ADDR + 1
+    for name in profile_decode.NAMES:
+        count, _, worst, total = profile_decode.RECORD.unpack_from(eeprom, offset)
+        offset += profile_decode.RECORD.size
+        cycles[name] = (total / count if count else 0.0, worst)
+    return cycles
+
+
+def report(names, memories, cycles):
+    base = names[0]
+    print()
+    print("%-22s" % "" + "".join("%12s" % n for n in names) + "%12s" % "difference")
+
+    for memory in ("program", "data", "eeprom"):
+        if not all(memory in m for m in memories):
+            continue
+        values = [m[memory][0] for m in memories]
+        units = memories[0][memory][1]
+        label = "%s (%s)" % (memory, units)
+        print("%-22s" % label + "".join("%12d" % v for v in values) + "%+12d" % (values[-1] - values[0]))
+
+    for row in CYCLE_ROWS if cycles else []:
+        avg = [c[row][0] for c in cycles]
+        worst = [c[row][1] for c in cycles]
+        print("%-22s" % (row + " avg") + "".join("%12.1f" % v for v in avg) + "%+12.1f" % (avg[-1] - avg[0]))
+        print("%-22s" % (row + " max") + "".join("%12d" % v for v in worst) + "%+12d" % (worst[-1] - worst[0]))
+
+    print()
+    print("Differences are the last variant less the %s image. Cycles are instruction cycles" % base)
+    print("Images are in %s" % os.path.normpath(OUTPUT_DIR))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build the firmware variants and compare them")
+    parser.add_argument("--profile", action="store_true", help="build every variant with the cycle profiler")
+    parser.add_argument("--make", default="make", help="make executable (MPLAB ships its own gnumake)")
+    parser.add_argument("--dumps", nargs=len(VARIANTS), metavar="HEX",
+                        help="EEPROM dumps of profiled runs, one per variant in order")
+    args = parser.parse_args()
+
+    names = [name for name, _ in VARIANTS]
+    memories = []
+    if args.dumps:
+        # Compare the images already built, alongside the dumps from running them
+        for name in names:
+            memories.append(memory_used(os.path.join(OUTPUT_DIR, name, "memoryfile.xml")))
+    else:
+        for name, defines in VARIANTS:
+            print("Building the %s image" % name)
+            build(args.make, defines + (["ENABLE_PROFILER"] if args.profile else []))
+            memories.append(memory_used(collect(name)))
+
+    cycles = [tick_cycles(path) for path in args.dumps] if args.dumps else None
+    report(names, memories, cycles)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,232 @@
+# Split a current-probe capture into per-task and per-state charge, using the
+# DEBUG_PIN event trace (see trace.h) captured on a synchronized marker channel.
+#
+# Build the firmware with ENABLE_TRACE, capture the supply current and DEBUG_PIN
+# together, and export them as CSV with one row per sample:
+#
+#   time [s], current, marker
+#
+#   python charge_attribution.py capture.csv [--current-scale 1e-6] [--samplerate HZ]
+#
+# The capture is processed in a single streaming pass, so it can be any length.
+# Only samples that fall inside a not-yet-decoded trace frame are held back,
+# since an event isn't known until its frame ends.
+#
+# Reports charge (nC) and average current (uA) by tick task, by clock speed, by
+# BOR detection state, by whether a timer callback (e.g., an LED blink) is
+# pending and by whether an ADC conversion is running, plus the average current
+# with each feature enabled and disabled
+#
+# Events that happen at CLK_SLOW (e.g., a timer callback firing between ticks)
+# are held back by the firmware and sent at the next faster clock, usually the
+# next tick, so their state changes are attributed from then on
+
+import argparse
+import sys
+from collections import defaultdict
+
+from trace_decode import FrameDecoder, EVENT_NAMES
+
+EVENT = {name: i for i, name in enumerate(EVENT_NAMES)}
+
+# Same order as task_t in main.c
+TASK_NAMES = ["self_test", "vcc", "rf_level", "rf_sample", "supercap", "leds", "calibration", "anim",
+              "supercap_model"]
+
+# Same order as clock_speed_t in main.c
+CLOCK_NAMES = ["CLK_SLOW", "CLK_MED", "CLK_2MHZ", "CLK_4MHZ", "CLK_8MHZ", "CLK_12MHZ", "CLK_FAST"]
+
+# Bits of PREFS_FEATURE_BITS()
+FEATURE_NAMES = ["tree_star", "harvest_stoker", "harvest_blink", "fast_blinks", "self_test"]
+
+# Abandon a partial trace frame after this much idle time on the marker
+FRAME_TIMEOUT_S = 0.1
+
+DIMENSIONS = ["task", "clock", "bor", "timer", "adc"]
+
+
+class State:
+    def __init__(self):
+        self.task = "startup"
+        self.clock = "unknown"
+        self.bor = "unknown"
+        self.timer = "no callback"
+        self.adc = "idle"
+        self.features = None
+        self.ticks = 0
+
+    def apply(self, event_id, value):
+        if event_id == EVENT["TICK_BEGIN"]:
+            self.task = "tick"
+            self.ticks += 1
+        elif event_id == EVENT["TICK_END"]:
+            self.task = "sleep"
+        elif event_id == EVENT["TASK"]:
+            self.task = TASK_NAMES[value] if value < len(TASK_NAMES) else "task_%d" % value
+        elif event_id == EVENT["CLOCK"]:
+            self.clock = CLOCK_NAMES[value] if value < len(CLOCK_NAMES) else "clock_%d" % value
+        elif event_id == EVENT["BOR"]:
+            self.bor = "BOR on" if value else "BOR off"
+        elif event_id == EVENT["TIMER_SET"]:
+            self.timer = "callback pending"
+        elif event_id == EVENT["TIMER_FIRE"]:
+            self.timer = "no callback"
+        elif event_id == EVENT["ADC_BEGIN"]:
+            self.adc = "converting"
+        elif event_id == EVENT["ADC_END"]:
+            self.adc = "idle"
+        elif event_id == EVENT["FEATURES"]:
+            self.features = value
+
+
+class Accounts:
+    def __init__(self):
+        # dimension -> state -> [charge in C, time in s]
+        self.by = {d: defaultdict(lambda: [0.0, 0.0]) for d in DIMENSIONS}
+        # feature -> enabled -> [charge, time]
+        self.features = [defaultdict(lambda: [0.0, 0.0]) for _ in FEATURE_NAMES]
+        self.total = [0.0, 0.0]
+        self.trace = [0.0, 0.0]
+
+    def add(self, state, charge, dt):
+        for d in DIMENSIONS:
+            acc = self.by[d][getattr(state, d)]
+            acc[0] += charge
+            acc[1] += dt
+        if state.features is not None:
+            for bit in range(len(FEATURE_NAMES)):
+                acc = self.features[bit][bool(state.features & (1 << bit))]
+                acc[0] += charge
+                acc[1] += dt
+        self.total[0] += charge
+        self.total[1] += dt
+
+
+def read_samples(f, args):
+    index = 0
+    for line in f:
+        fields = line.split(",")
+        try:
+            if args.samplerate:
+                t = index / args.samplerate
+                index += 1
+            else:
+                t = float(fields[args.time_col])
+            current = float(fields[args.current_col]) * args.current_scale
+            marker = float(fields[args.marker_col])
+        except (ValueError, IndexError):
+            continue  # header or comment line
+        yield t, current, 1 if marker > args.marker_threshold else 0
+
+
+def attribute(f, args):
+    state = State()
+    accounts = Accounts()
+    decoder = FrameDecoder()
+    held = []  # (charge, dt) intervals inside the trace frame in progress
+    level = None
+    prev = None
+
+    for t, current, marker in read_samples(f, args):
+        event = None
+        if marker != level:
+            level = marker
+            event = decoder.feed(t, marker)
+        else:
+            decoder.timeout(t, FRAME_TIMEOUT_S)
+
+        if event is not None:
+            # The frame's intervals belong to the state it announces
+            state.apply(event[1], event[2])
+            for charge, dt in held:
+                accounts.add(state, charge, dt)
+                accounts.trace[0] += charge
+                accounts.trace[1] += dt
+            held = []
+        elif decoder.pending_since() is None and held:
+            # Undecodable frame, so leave the state alone
+            for charge, dt in held:
+                accounts.add(state, charge, dt)
+            held = []
+
+        if prev is not None:
+            dt = t - prev[0]
+            charge = prev[1] * dt
+            if decoder.pending_since() is not None:
+                held.append((charge, dt))
+            else:
+                accounts.add(state, charge, dt)
+
+        prev = (t, current)
+
+    for charge, dt in held:
+        accounts.add(state, charge, dt)
+
+    return accounts, state.ticks, len(decoder.errors)
+
+
+def average_ua(acc):
+    return acc[0] / acc[1] * 1e6 if acc[1] > 0 else 0.0
+
+
+def report(accounts, ticks, errors):
+    total_charge, total_time = accounts.total
+    if total_time <= 0:
+        print("No samples")
+        return
+
+    print("Capture: %.3f s, %.1f nC, average %.2f uA, %d ticks" % (
+        total_time, total_charge * 1e9, average_ua(accounts.total), ticks))
+    print("Trace frames: %.1f nC (%.2f%% of charge)" % (
+        accounts.trace[0] * 1e9, 100.0 * accounts.trace[0] / total_charge if total_charge else 0.0))
+
+    for d in DIMENSIONS:
+        print()
+        print("%-18s %12s %10s %12s %10s %8s" % ("by " + d, "charge [nC]", "share", "time [ms]", "avg [uA]",
+                                                 "nC/tick" if d == "task" else ""))
+        rows = sorted(accounts.by[d].items(), key=lambda kv: -kv[1][0])
+        for name, acc in rows:
+            per_tick = "%8.2f" % (acc[0] * 1e9 / ticks) if d == "task" and ticks else ""
+            print("%-18s %12.1f %9.2f%% %12.2f %10.2f %s" % (
+                name, acc[0] * 1e9, 100.0 * acc[0] / total_charge if total_charge else 0.0,
+                acc[1] * 1e3, average_ua(acc), per_tick))
+
+    print()
+    print("%-18s %14s %14s %10s" % ("feature", "enabled [uA]", "disabled [uA]", "delta"))
+    for bit, name in enumerate(FEATURE_NAMES):
+        on = accounts.features[bit][True]
+        off = accounts.features[bit][False]
+        if on[1] > 0 and off[1] > 0:
+            delta = "%10.2f" % (average_ua(on) - average_ua(off))
+        else:
+            delta = "%10s" % "-"
+        print("%-18s %14s %14s %s" % (
+            name,
+            "%.2f" % average_ua(on) if on[1] > 0 else "-",
+            "%.2f" % average_ua(off) if off[1] > 0 else "-",
+            delta))
+
+    if errors:
+        print()
+        print("%d undecodable trace frames" % errors)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Attribute a current capture to firmware tasks and states")
+    parser.add_argument("csv", help="CSV export ('-' for stdin)")
+    parser.add_argument("--time-col", type=int, default=0)
+    parser.add_argument("--current-col", type=int, default=1)
+    parser.add_argument("--marker-col", type=int, default=2)
+    parser.add_argument("--current-scale", type=float, default=1.0,
+                        help="amps per unit of the current column (e.g., 1e-6 for uA)")
+    parser.add_argument("--marker-threshold", type=float, default=0.5,
+                        help="marker level above which DEBUG_PIN is high (e.g., 1.5 for an analog channel)")
+    parser.add_argument("--samplerate", type=float, help="sample rate, for exports without a time column")
+    args = parser.parse_args()
+
+    f = sys.stdin if args.csv == "-" else open(args.csv)
+    report(*attribute(f, args))
+
+
+if __name__ == "__main__":
+    main()
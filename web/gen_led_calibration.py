@@ -0,0 +1,115 @@
+"""
+Generates Christmas2024.X/led_calibration.h, the per-LED on-time scale factors
+that LED_twinkle() in leds.c applies to each blink, from bench measurements of
+the LEDs (led_measurements.csv).
+
+The eye sees a blink this short by the light it puts out, intensity times
+on-time. The on-time of every LED is scaled so that its blink puts out the same
+light as the median LED's (times its target, if any), so the tree looks about as
+bright as before, only more even. Brighter LEDs are shortened and dimmer ones
+lengthened, up to the largest scale the firmware holds (255 in Q7, about 2x);
+an LED that needs more than that stays a little dim. The charge of a blink is
+the LED current times the on-time, since it all comes from the same Vcc; the
+forward voltage and efficiency of each LED already show up in its current and
+intensity.
+
+The harvest LEDs (port C) light as their pin is pulled low, not for the length
+of the pulse, so their on-time can't be scaled. They keep a scale of 1.0.
+
+Usage: python gen_led_calibration.py [measurements.csv] [output path]
+"""
+
+import csv
+import os
+import sys
+
+from gen_twinkle_schedule import TWINKLE_CYCLE, PORTS
+
+PINS = len(PORTS) * 8
+SCALE_ONE = 128  # Q7
+SCALE_MAX = 255  # cLedOnTimeScaleQ7 is a byte
+
+
+def read_measurements(path):
+    """The measured LEDs, as {(port, pin): (current_ua, intensity_mcd, target)}"""
+    leds = {}
+    with open(path, newline="") as f:
+        rows = csv.DictReader(line for line in f if not line.startswith("#"))
+        for row in rows:
+            step = (row["port"].strip(), int(row["pin"]))
+            if not row["intensity_mcd"].strip():
+                continue
+            current = float(row["current_ua"]) if row["current_ua"].strip() else None
+            target = float(row["target"]) if row["target"].strip() else 1.0
+            leds[step] = (current, float(row["intensity_mcd"]), target)
+    return leds
+
+
+def scales(leds):
+    """On-time scale of each measured LED, with the median (per its target) at 1.0"""
+    tunable = {step: m for step, m in leds.items() if step[0] != "C"}
+    if not tunable:
+        return {}
+    brightness = sorted(intensity / target for _, intensity, target in tunable.values())
+    middle = len(brightness) // 2
+    if len(brightness) % 2:
+        reference = brightness[middle]
+    else:
+        reference = (brightness[middle - 1] + brightness[middle]) / 2
+    return {step: min(target * reference / intensity, SCALE_MAX / SCALE_ONE)
+            for step, (_, intensity, target) in tunable.items()}
+
+
+def report(leds, scale):
+    """Charge per twinkle cycle before and after, for the LEDs with a measured current"""
+    before = 0.0
+    after = 0.0
+    for step in TWINKLE_CYCLE:
+        if step is None or step not in leds or leds[step][0] is None:
+            continue
+        before += leds[step][0]
+        after += leds[step][0] * scale.get(step, 1.0)
+    for step in sorted(scale):
+        print("  %s%d: %.3f" % (step[0], step[1], scale[step]))
+    if before:
+        print("LED charge per twinkle cycle: %.0f%% of uncalibrated" % (100.0 * after / before))
+
+
+def generate(scale):
+    values = [SCALE_ONE] * PINS
+    for (port, pin), s in scale.items():
+        values[PORTS.index(port) * 8 + pin] = min(max(1, int(round(s * SCALE_ONE))), SCALE_MAX)
+
+    lines = []
+    lines.append("// Generated by web/gen_led_calibration.py. Edit the measurements, not this file")
+    lines.append("#ifndef __LED_CALIBRATION_H")
+    lines.append("#define __LED_CALIBRATION_H")
+    lines.append("")
+    lines.append('#include "global.h"')
+    lines.append("")
+    lines.append("#define LED_CALIBRATION_PINS        (%d)" % PINS)
+    lines.append("")
+    lines.append("// On-time scale of each LED pin, by its offset from RA0PPS, in Q7 (128 is 1.0)")
+    lines.append("static const uint8_t cLedOnTimeScaleQ7[LED_CALIBRATION_PINS] =")
+    lines.append("{")
+    for port in range(len(PORTS)):
+        row = values[port * 8:(port + 1) * 8]
+        lines.append("    " + ", ".join("%3d" % v for v in row) + ", // port %s" % PORTS[port])
+    lines.append("};")
+    lines.append("")
+    lines.append("#endif")
+    # The firmware sources use CRLF line endings
+    return ("\n".join(lines) + "\n").replace("\n", "\r\n")
+
+
+if __name__ == "__main__":
+    here = os.path.dirname(os.path.abspath(__file__))
+    source = sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, "led_measurements.csv")
+    path = sys.argv[2] if len(sys.argv) > 2 else os.path.join(here, "..", "Christmas2024.X", "led_calibration.h")
+
+    leds = read_measurements(source)
+    scale = scales(leds)
+    report(leds, scale)
+    with open(path, "w", newline="") as f:
+        f.write(generate(scale))
+    print("Wrote %s" % os.path.normpath(path))
@@ -0,0 +1,152 @@
+"""
+Generates Christmas2024.X/twinkle_schedule.h, the flash-resident twinkle
+schedules used by LED_twinkle() in leds.c.
+
+The twinkle cycle (the order of LEDs that a random index picks from) lives here
+now. For every combination of the preferences that decide what a step does
+(tree star, harvest-rail stoking, harvest blinks), the rules that LED_twinkle()
+used to apply on every tick are resolved ahead of time into one action per
+step. The firmware then just looks up the action and the pin for the step.
+
+Usage: python gen_twinkle_schedule.py [output path]
+"""
+
+import os
+import sys
+
+TREE_STAR = ("B", 4)
+HARVEST_STOKE = ("C", 3)
+
+# The twinkle cycle, as (port, pin), or None for an idle step. Each step is
+# equally likely on any given twinkle, so an LED's share of the steps is its
+# share of the twinkles
+TWINKLE_CYCLE = [
+    ("B", 1),
+    TREE_STAR,
+    ("A", 2),
+    None,
+    ("B", 0),
+    ("A", 4),
+    ("C", 0),
+    ("B", 5),
+    ("B", 3),
+    ("A", 5),
+    TREE_STAR,
+    ("B", 2),
+    ("A", 7),
+    ("C", 1),
+    HARVEST_STOKE,  # "stoke" the harvest LED rail
+    TREE_STAR,
+]
+
+# Brightness of each LED, as a right shift of full brightness (0 is full, 3 is an
+# eighth), for LEDs that should be dimmer than the rest. led_pulse_prepare() in
+# leds.c turns a dimmed blink into a shorter full-brightness one where it can.
+# The harvest LEDs light while their pin is low rather than while it pulses, so
+# they can't be dimmed. None is dimmed for now, so the dimming hardware is only
+# used by animation programs
+LED_LEVELS = {
+    # ("A", 7): 1, for example, for half brightness
+}
+LEVEL_MAX = 3
+
+# Preference bits of the schedule index, matching TWINKLE_SCHEDULE_INDEX()
+PREFS = ["treeStarEn", "harvestRailChargeEn", "harvestBlinkEn"]
+
+ACTIONS = ["TWINKLE_IDLE", "TWINKLE_PULSE", "TWINKLE_PULSE_HARVEST", "TWINKLE_STOKE"]
+
+PORTS = "ABC"
+
+
+def pin_entry(step):
+    """Pin of a step (offset from RA0PPS) in the low five bits, brightness above"""
+    if step is None:
+        return 0
+    port, pin = step
+    level = LED_LEVELS.get(step, 0)
+    assert 0 <= level <= LEVEL_MAX
+    assert port != "C" or level == 0, "harvest LEDs can't be dimmed"
+    return (level << 5) | (PORTS.index(port) * 8 + pin)
+
+
+def step_action(step, prefs):
+    """The action for one step under one combination of preferences"""
+    if step is None:
+        return "TWINKLE_IDLE"
+
+    port, _ = step
+    if port != "C":
+        # Allow the tree star to be enabled or disabled
+        if step == TREE_STAR and not prefs["treeStarEn"]:
+            return "TWINKLE_IDLE"
+        return "TWINKLE_PULSE"
+
+    # Allow the harvest LEDs to be enabled or disabled. With stoking off, the
+    # stoker pin blinks like the other harvest LEDs
+    if step == HARVEST_STOKE and prefs["harvestRailChargeEn"]:
+        return "TWINKLE_STOKE"
+    if prefs["harvestBlinkEn"]:
+        return "TWINKLE_PULSE_HARVEST"
+    return "TWINKLE_IDLE"
+
+
+def generate():
+    lines = []
+    lines.append("// Generated by web/gen_twinkle_schedule.py. Edit the generator, not this file")
+    lines.append("#ifndef __TWINKLE_SCHEDULE_H")
+    lines.append("#define __TWINKLE_SCHEDULE_H")
+    lines.append("")
+    lines.append('#include "global.h"')
+    lines.append("")
+    lines.append("#define TWINKLE_SCHEDULE_LENGTH     (%d)" % len(TWINKLE_CYCLE))
+    lines.append("#define TWINKLE_SCHEDULE_COMBOS     (%d)" % (1 << len(PREFS)))
+    lines.append("")
+    lines.append("// Index of the schedule for a set of preferences")
+    terms = ["(_prefs).%s << %d" % (name, bit) for bit, name in enumerate(PREFS)]
+    lines.append("#define TWINKLE_SCHEDULE_INDEX(_prefs)  (uint8_t)(%s)" % " | \\\n                                                ".join(terms))
+    lines.append("")
+    lines.append("// Pin (offset from RA0PPS) and brightness level of a cTwinklePins entry")
+    lines.append("#define TWINKLE_PIN_INDEX(_entry)   (uint8_t)((_entry) & 0x1F)")
+    lines.append("#define TWINKLE_PIN_LEVEL(_entry)   (uint8_t)((_entry) >> 5)")
+    lines.append("")
+    lines.append("typedef enum")
+    lines.append("{")
+    for action in ACTIONS:
+        lines.append("    %s," % action)
+    lines.append("} twinkle_action_t;")
+    lines.append("")
+    lines.append("// Pin of each step, as its offset from RA0PPS (port * 8 + pin), with its brightness level")
+    lines.append("static const uint8_t cTwinklePins[TWINKLE_SCHEDULE_LENGTH] =")
+    lines.append("{")
+    pins = ["0x%02X" % pin_entry(step) for step in TWINKLE_CYCLE]
+    lines.append("    " + ", ".join(pins) + ",")
+    lines.append("};")
+    lines.append("")
+    lines.append("// Pin mask of each step within its port")
+    lines.append("static const uint8_t cTwinkleMasks[TWINKLE_SCHEDULE_LENGTH] =")
+    lines.append("{")
+    masks = ["0x%02X" % ((1 << step[1]) if step else 0) for step in TWINKLE_CYCLE]
+    lines.append("    " + ", ".join(masks) + ",")
+    lines.append("};")
+    lines.append("")
+    lines.append("// Action (twinkle_action_t) of each step, for each combination of preferences")
+    lines.append("static const uint8_t cTwinkleActions[TWINKLE_SCHEDULE_COMBOS][TWINKLE_SCHEDULE_LENGTH] =")
+    lines.append("{")
+    for index in range(1 << len(PREFS)):
+        prefs = {name: bool(index & (1 << bit)) for bit, name in enumerate(PREFS)}
+        label = ", ".join("%s=%d" % (name, prefs[name]) for name in PREFS)
+        actions = [ACTIONS.index(step_action(step, prefs)) for step in TWINKLE_CYCLE]
+        lines.append("    { %s }, // %s" % (", ".join(str(a) for a in actions), label))
+    lines.append("};")
+    lines.append("")
+    lines.append("#endif")
+    # The firmware sources use CRLF line endings
+    return ("\n".join(lines) + "\n").replace("\n", "\r\n")
+
+
+if __name__ == "__main__":
+    here = os.path.dirname(os.path.abspath(__file__))
+    path = sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, "..", "Christmas2024.X", "twinkle_schedule.h")
+    with open(path, "w", newline="") as f:
+        f.write(generate())
+    print("Wrote %s" % os.path.normpath(path))
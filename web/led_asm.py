@@ -0,0 +1,167 @@
+"""
+Assembles an LED animation program for the EEPROM interpreter in anim.c (see
+anim.h for the instruction set) into an Intel HEX file of the data EEPROM area
+that a programmer can write without touching the firmware.
+
+Source format, one instruction per line, ';' starts a comment:
+
+    top:
+        VCC 14, bright      ; Vcc above guard level 14 (2340 mV)?
+        LED B4, 4, 1        ; tree star, 1 ms at half brightness
+        WAIT 3
+        END
+    bright:
+        LED B4, 12          ; tree star plus one tree LED, 3 ms each
+        RAND 15, other      ; half the time
+        LED A2, 12
+        WAIT 1
+        END
+    other:
+        LED B1, 12
+        WAIT 1
+        END
+
+LED takes a pin (port letter and bit), an on-time in quarter milliseconds (1 to
+63) and an optional brightness level (0 to 3, a right shift of full brightness).
+The pin must be an LED's: A1-A5, A7, B0-B5, or the harvest LEDs C0 and C1, which
+can't be dimmed. The firmware stops a program that names any other pin.
+JUMP target is RAND 31, target.
+
+Usage: python led_asm.py program.anim [output.hex]
+"""
+
+import os
+import sys
+
+ANIM_MAGIC = 0xA5
+ANIM_ADDR = 0x80
+ANIM_PROGRAM_LEN = 0x40 - 1
+
+# The data EEPROM sits at 0xF000 (in words), and a PIC16 hex file holds one byte
+# per word, at twice the word address
+EEPROM_HEX_ADDR = 0xF000 * 2
+
+OPS = {"END": 0b000, "LED": 0b001, "WAIT": 0b010, "RAND": 0b011, "VCC": 0b100, "LOOP": 0b101}
+PORTS = "ABC"
+
+# The LED pins of each port, as cLedPinMasks in leds.c. The others include
+# KEEP_ON_PIN (C4), the charger's PWM output (C7) and the RF input (A0)
+LED_PIN_MASKS = {"A": 0b10111110, "B": 0b00111111, "C": 0b00000011}
+
+
+class AsmError(Exception):
+    pass
+
+
+def parse_int(text, low, high, what):
+    try:
+        value = int(text, 0)
+    except ValueError:
+        raise AsmError("bad %s '%s'" % (what, text))
+    if not low <= value <= high:
+        raise AsmError("%s %d is out of range (%d to %d)" % (what, value, low, high))
+    return value
+
+
+def parse_pin(text):
+    text = text.strip().upper()
+    if len(text) != 2 or text[0] not in PORTS or not text[1].isdigit() or int(text[1]) > 7:
+        raise AsmError("bad pin '%s'" % text)
+    if not LED_PIN_MASKS[text[0]] & (1 << int(text[1])):
+        raise AsmError("%s isn't an LED pin" % text)
+    return PORTS.index(text[0]) * 8 + int(text[1])
+
+
+def parse(source):
+    """The program as a list of (line number, mnemonic, arguments), and its labels"""
+    program = []
+    labels = {}
+    address = 0
+    for number, line in enumerate(source.splitlines(), 1):
+        line = line.split(";", 1)[0].strip()
+        if not line:
+            continue
+        if line.endswith(":"):
+            labels[line[:-1].strip()] = address
+            continue
+        parts = line.split(None, 1)
+        mnemonic = parts[0].upper()
+        args = [a.strip() for a in parts[1].split(",")] if len(parts) > 1 else []
+        if mnemonic == "JUMP":
+            mnemonic, args = "RAND", ["31"] + args
+        if mnemonic not in OPS:
+            raise AsmError("line %d: unknown instruction '%s'" % (number, parts[0]))
+        program.append((number, mnemonic, args))
+        address += 1 if mnemonic in ("END", "WAIT") else 2
+    return program, labels
+
+
+def assemble(source):
+    program, labels = parse(source)
+    out = []
+    for number, mnemonic, args in program:
+        try:
+            if mnemonic == "END":
+                if args:
+                    raise AsmError("END takes no arguments")
+                out.append(OPS["END"] << 5)
+            elif mnemonic == "WAIT":
+                if len(args) != 1:
+                    raise AsmError("WAIT takes a tick count")
+                out.append(OPS["WAIT"] << 5 | parse_int(args[0], 0, 31, "tick count"))
+            elif mnemonic == "LED":
+                if len(args) not in (2, 3):
+                    raise AsmError("LED takes a pin, an on-time and an optional level")
+                level = parse_int(args[2], 0, 3, "level") if len(args) == 3 else 0
+                pin = parse_pin(args[0])
+                if pin >= PORTS.index("C") * 8 and level:
+                    raise AsmError("harvest LEDs can't be dimmed")
+                out.append(OPS["LED"] << 5 | pin)
+                out.append(level << 6 | parse_int(args[1], 1, 63, "on-time"))
+            else:
+                if len(args) != 2:
+                    raise AsmError("%s takes an argument and a target" % mnemonic)
+                if args[1] not in labels:
+                    raise AsmError("unknown label '%s'" % args[1])
+                out.append(OPS[mnemonic] << 5 | parse_int(args[0], 0, 31, "argument"))
+                out.append(labels[args[1]])
+        except AsmError as e:
+            raise AsmError("line %d: %s" % (number, e))
+    if len(out) > ANIM_PROGRAM_LEN:
+        raise AsmError("program is %d bytes, the limit is %d" % (len(out), ANIM_PROGRAM_LEN))
+    return bytes([ANIM_MAGIC] + out)
+
+
+def hex_record(address, kind, data):
+    record = [len(data), (address >> 8) & 0xFF, address & 0xFF, kind] + list(data)
+    checksum = (-sum(record)) & 0xFF
+    return ":" + "".join("%02X" % b for b in record) + "%02X" % checksum
+
+
+def to_hex(image):
+    base = EEPROM_HEX_ADDR + ANIM_ADDR * 2
+    lines = [hex_record(0, 0x04, [(base >> 24) & 0xFF, (base >> 16) & 0xFF])]
+    words = []
+    for b in image:
+        words += [b, 0x00]
+    for offset in range(0, len(words), 16):
+        lines.append(hex_record((base + offset) & 0xFFFF, 0x00, words[offset:offset + 16]))
+    lines.append(hex_record(0, 0x01, []))
+    return "\n".join(lines) + "\n"
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    source = sys.argv[1]
+    path = sys.argv[2] if len(sys.argv) > 2 else os.path.splitext(source)[0] + ".hex"
+    try:
+        image = assemble(open(source).read())
+    except AsmError as e:
+        print("%s: %s" % (source, e))
+        sys.exit(1)
+    with open(path, "w") as f:
+        f.write(to_hex(image))
+    print("%d bytes: %s" % (len(image), " ".join("%02X" % b for b in image)))
+    print("Wrote %s" % os.path.normpath(path))
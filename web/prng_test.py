@@ -0,0 +1,198 @@
+"""
+Statistical checks of the firmware's PRNG (ADC_random_int() in adc.c), run on
+the host with a bit-exact model of it.
+
+The generator is a 16-bit xorshift (shifts 7, 9, 8) that returns its low byte,
+with ADC noise XORed into the low byte after each conversion. The old 7-bit
+LFSR is modelled too, for comparison.
+
+Each test fails if its p-value is below P_MIN, a sequence too uneven for chance,
+or above P_MAX, one too even for chance. The bare xorshift is too even: over
+more than about ten thousand outputs its low byte covers the values more evenly
+than random bytes would, as the generator visits each state once per period.
+The firmware never runs it bare, so only the output with ADC entropy mixed in
+has to pass. The bare generator and the old LFSR are reported for reference.
+
+Usage: python prng_test.py [samples]
+"""
+
+import math
+import random
+import sys
+
+INITIAL_STATE = 0x35A7
+
+# Two-sided bounds on each test's p-value
+P_MIN = 0.001
+P_MAX = 0.999
+
+
+def xorshift16_step(state):
+    """One step of ADC_random_int(), on the whole 16-bit state"""
+    state ^= (state << 7) & 0xFFFF
+    state ^= state >> 9
+    state ^= (state << 8) & 0xFFFF
+    return state
+
+
+def xorshift16_bytewise_step(hi, lo):
+    """The same step, exactly as the firmware does it, a byte at a time"""
+    carry = (lo << 7) & 0xFF
+    hi ^= ((hi << 7) & 0xFF) | (lo >> 1)
+    lo ^= carry
+    lo ^= hi >> 1
+    hi ^= lo
+    return hi, lo
+
+
+def xorshift16_outputs(count, entropy_every=0, noise_bits=2, seed=1):
+    """
+    Outputs of ADC_random_int(). If entropy_every is non-zero, a sample with
+    noise_bits of noise is mixed in after that many calls, standing in for the
+    ADC conversions that happen between twinkles
+    """
+    rng = random.Random(seed)
+    state = INITIAL_STATE
+    out = []
+    for i in range(count):
+        if entropy_every and i % entropy_every == 0:
+            state ^= rng.getrandbits(noise_bits)
+            if state == 0:
+                state = INITIAL_STATE & 0xFF00
+        state = xorshift16_step(state)
+        out.append(state & 0xFF)
+    return out
+
+
+def lfsr7_outputs(count, seed=0x35):
+    """Outputs of the old 7-bit LFSR, without its periodic reseeding"""
+    state = seed
+    out = []
+    for _ in range(count):
+        feedback = 1 if ((state >> 1) ^ state) & 0b00100000 else 0
+        state = ((state << 1) & 0xFF) | feedback
+        out.append(state)
+    return out
+
+
+def chi_square_p(stat, dof):
+    """Upper-tail p-value of a chi-square statistic (Wilson-Hilferty approximation)"""
+    z = ((stat / dof) ** (1 / 3) - (1 - 2 / (9 * dof))) / math.sqrt(2 / (9 * dof))
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def normal_p(z):
+    """Two-sided p-value of a standard normal statistic"""
+    return math.erfc(abs(z) / math.sqrt(2))
+
+
+def test_uniform(values, buckets):
+    """Chi-square test of the values (already reduced to 0..buckets-1) for uniformity"""
+    expected = len(values) / buckets
+    counts = [0] * buckets
+    for v in values:
+        counts[v] += 1
+    stat = sum((c - expected) ** 2 / expected for c in counts)
+    return chi_square_p(stat, buckets - 1)
+
+
+def test_pairs(values, bits):
+    """Chi-square test of consecutive pairs of bits-wide values (serial test)"""
+    mask = (1 << bits) - 1
+    pairs = [((a & mask) << bits) | (b & mask) for a, b in zip(values[::2], values[1::2])]
+    return test_uniform(pairs, 1 << (2 * bits))
+
+
+def test_runs(values, bit):
+    """Wald-Wolfowitz runs test on one bit of each value"""
+    seq = [(v >> bit) & 1 for v in values]
+    ones = sum(seq)
+    zeros = len(seq) - ones
+    if ones == 0 or zeros == 0:
+        return 0.0
+    runs = 1 + sum(1 for a, b in zip(seq, seq[1:]) if a != b)
+    n = len(seq)
+    mean = 2 * ones * zeros / n + 1
+    var = (mean - 1) * (mean - 2) / (n - 1)
+    return normal_p((runs - mean) / math.sqrt(var))
+
+
+def test_correlation(values, lag=1):
+    """Serial correlation of the values at the given lag, as a two-sided p-value"""
+    n = len(values) - lag
+    mean = sum(values) / len(values)
+    var = sum((v - mean) ** 2 for v in values) / len(values)
+    cov = sum((values[i] - mean) * (values[i + lag] - mean) for i in range(n)) / n
+    return normal_p(cov / var * math.sqrt(n))
+
+
+def test_rf_gaps(values, mask=0x0F, hit_below=4):
+    """
+    Chi-square test of the gaps between RF level sampling ticks in main.c (a hit
+    whenever (random & mask) < hit_below), against the geometric distribution
+    """
+    p = hit_below / (mask + 1)
+    gaps = []
+    last = None
+    for i, v in enumerate(values):
+        if (v & mask) < hit_below:
+            if last is not None:
+                gaps.append(i - last)
+            last = i
+    max_gap = 16
+    counts = [0] * (max_gap + 1)
+    for g in gaps:
+        counts[min(g, max_gap)] += 1
+    expected = [len(gaps) * p * (1 - p) ** (g - 1) for g in range(1, max_gap)]
+    expected.append(len(gaps) * (1 - p) ** (max_gap - 1))
+    stat = sum((c - e) ** 2 / e for c, e in zip(counts[1:], expected))
+    return chi_square_p(stat, max_gap - 1)
+
+
+def run_suite(name, values):
+    results = [
+        ("byte uniformity", test_uniform(values, 256)),
+        ("low nibble uniformity", test_uniform([v & 0x0F for v in values], 16)),
+        ("low nibble pairs", test_pairs(values, 4)),
+        ("bit 0 runs", test_runs(values, 0)),
+        ("bit 7 runs", test_runs(values, 7)),
+        ("lag-1 correlation", test_correlation(values, 1)),
+        ("RF sampling gaps", test_rf_gaps(values)),
+    ]
+    print(f"{name}:")
+    failures = 0
+    for test, p in results:
+        verdict = "ok" if P_MIN <= p <= P_MAX else "FAIL"
+        if verdict != "ok":
+            failures += 1
+        print(f"  {test:24s} p = {p:8.5f}  {verdict}")
+    return failures
+
+
+def check_firmware_model():
+    """The byte-wise step matches the 16-bit one for every state, and the period is full"""
+    for x in range(1, 1 << 16):
+        hi, lo = xorshift16_bytewise_step(x >> 8, x & 0xFF)
+        assert (hi << 8) | lo == xorshift16_step(x), f"byte-wise step differs at {x:#06x}"
+    state = INITIAL_STATE
+    period = 0
+    while True:
+        state = xorshift16_step(state)
+        period += 1
+        if state == INITIAL_STATE:
+            break
+    assert period == 0xFFFF, f"period is {period}"
+    print(f"Firmware model matches, period {period}")
+
+
+if __name__ == "__main__":
+    samples = int(sys.argv[1]) if len(sys.argv) > 1 else 65535
+
+    check_firmware_model()
+
+    failures = 0
+    failures += run_suite("xorshift16 with ADC entropy", xorshift16_outputs(samples, entropy_every=4))
+    run_suite("bare xorshift16 (for reference)", xorshift16_outputs(samples))
+    run_suite("old 7-bit LFSR (for reference)", lfsr7_outputs(samples))
+
+    sys.exit(1 if failures else 0)
@@ -0,0 +1,91 @@
+# Decode the cycle profiler counters from a data EEPROM dump.
+#
+# Read the device with the programmer (e.g., MPLAB IPE with "EEPROM" selected),
+# export it as Intel HEX, and run:
+#
+#   python profile_decode.py dump.hex [fosc_mhz]
+#
+# Matches the layout in profile.h / nvm.h
+
+import struct
+import sys
+
+EEPROM_HEX_BASE = 0xF000 * 2  # PIC16 hex files use byte addresses, two per word
+PROFILE_ADDR = 0xC0
+PROFILE_MAGIC = 0xC5
+
+# Same order as profile_id_t
+NAMES = [
+    "system_tick",
+    "ADC_read_vcc",
+    "RF_sample_bit",
+    "rf_frame_decode",
+    "LED_twinkle",
+    "SUPERCAP_charge",
+]
+
+RECORD = struct.Struct("<HHHI")
+
+# Same order as boot_stage_t in main.c. One byte each after the records
+MILESTONES = ["ticking", "peripherals", "prefs"]
+
+
+def read_eeprom(path):
+    eeprom = bytearray([0xFF] * 256)
+    upper = 0
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith(":"):
+                continue
+            raw = bytes.fromhex(line[1:])
+            count, addr, rectype = raw[0], (raw[1] << 8) | raw[2], raw[3]
+            data = raw[4:4 + count]
+            if rectype == 4:
+                upper = (data[0] << 8) | data[1]
+            elif rectype == 0:
+                base = (upper << 16) | addr
+                for i, b in enumerate(data):
+                    a = base + i - EEPROM_HEX_BASE
+                    # Each EEPROM byte occupies the low byte of a word
+                    if 0 <= a < 512 and a % 2 == 0:
+                        eeprom[a // 2] = b
+    return eeprom
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: profile_decode.py dump.hex [fosc_mhz]")
+        sys.exit(1)
+
+    eeprom = read_eeprom(sys.argv[1])
+    fosc_mhz = float(sys.argv[2]) if len(sys.argv) > 2 else 16.0
+
+    if eeprom[PROFILE_ADDR] != PROFILE_MAGIC:
+        print("No profiler data (magic byte is 0x%02X)" % eeprom[PROFILE_ADDR])
+        sys.exit(1)
+
+    # Cycle counts are instruction cycles (Fosc/4) at whatever clock was running;
+    # the microsecond column assumes the given Fosc throughout
+    us_per_cycle = 4.0 / fosc_mhz
+
+    print("%-16s %7s %7s %7s %9s %9s" % ("function", "count", "min", "max", "avg", "avg_us"))
+    offset = PROFILE_ADDR + 1
+    for name in NAMES:
+        count, lo, hi, total = RECORD.unpack_from(eeprom, offset)
+        offset += RECORD.size
+        if count == 0:
+            print("%-16s %7d" % (name, 0))
+            continue
+        avg = total / count
+        print("%-16s %7d %7d %7d %9.1f %9.1f" % (name, count, lo, hi, avg, avg * us_per_cycle))
+
+    print()
+    print("boot milestone   tick (255 means 255 or later)")
+    for name in MILESTONES:
+        print("%-16s %4d" % (name, eeprom[offset]))
+        offset += 1
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,260 @@
+# Decode DEBUG_PIN event traces (see trace.h) from a logic-analyzer CSV export.
+#
+# Accepts one row per transition or per sample, with the time in seconds in the
+# first column and the DEBUG_PIN level (0/1) in another, e.g. a Saleae Logic
+# export ("Time [s],Channel 0"). For sample-per-row exports without a time
+# column (e.g., sigrok-cli -O csv), pass --samplerate. The file is processed as
+# a stream, so captures of any length are fine.
+#
+#   python trace_decode.py capture.csv [--channel 1] [--samplerate HZ] [--quiet]
+#
+# Prints a timeline of events, then per-event duration statistics for the
+# BEGIN/END pairs and histograms of durations and values.
+
+import argparse
+import csv
+import sys
+from collections import defaultdict
+
+FRAME_BITS = 14  # TRACE_FRAME_BITS
+SYNC_BITS = 0b10
+
+# Same order as trace_id_t
+EVENT_NAMES = [
+    "TICK_BEGIN",
+    "TICK_END",
+    "ADC_BEGIN",
+    "ADC_END",
+    "VCC",
+    "RF_LEVEL",
+    "RF_DECODE_BEGIN",
+    "RF_DECODE_END",
+    "SUPERCAP_STATE",
+    "SUPERCAP_DELTA",
+    "TASK",
+    "CLOCK",
+    "BOR",
+    "TIMER_SET",
+    "TIMER_FIRE",
+    "FEATURES",
+]
+
+# Spans to time, as (name, begin ID, end ID)
+SPANS = [
+    ("TICK", 0, 1),
+    ("ADC", 2, 3),
+    ("RF_DECODE", 6, 7),
+]
+
+# A low time this many times the frame's first low time ends the frame
+GAP_RATIO = 4.0
+
+HISTOGRAM_BINS = 10
+HISTOGRAM_WIDTH = 40
+
+
+def event_name(event_id):
+    if event_id < len(EVENT_NAMES):
+        return EVENT_NAMES[event_id]
+    return "EVENT_%d" % event_id
+
+
+def read_edges(f, channel, samplerate):
+    """Yield (time, level) for every change of level"""
+    level = None
+    index = 0
+    for row in csv.reader(f):
+        if not row or row[0].startswith(";") or row[0].startswith("#"):
+            continue
+        try:
+            if samplerate:
+                t = index / samplerate
+                value = int(float(row[channel]))
+                index += 1
+            else:
+                t = float(row[0])
+                value = int(float(row[channel]))
+        except (ValueError, IndexError):
+            continue  # header line
+        value = 1 if value else 0
+        if value != level:
+            level = value
+            yield t, value
+
+
+def decode_frame(highs):
+    """Return (event ID, value) from the high times of one frame, or None"""
+    # The sync bits give a long (1) and a short (0) reference pulse
+    threshold = (highs[0] + highs[1]) / 2.0
+    if highs[0] < 1.5 * highs[1]:
+        return None
+    bits = 0
+    for width in highs:
+        bits = (bits << 1) | (1 if width > threshold else 0)
+    if bits >> 12 != SYNC_BITS:
+        return None
+    return (bits >> 8) & 0x0F, bits & 0xFF
+
+
+class FrameDecoder:
+    """Incremental frame decoder. Feed it every edge of DEBUG_PIN in order"""
+
+    def __init__(self):
+        self.start = None  # time of the first rising edge of the frame in progress
+        self.highs = []
+        self.first_low = None
+        self.rise = None
+        self.fall = None
+        self.errors = []  # start times of undecodable frames
+
+    def pending_since(self):
+        """Start time of a frame in progress (whose event isn't known yet), or None"""
+        return self.start
+
+    def feed(self, t, level):
+        """Process one edge. Returns (time, event ID, value) if it completed a frame, else None"""
+        if level == 1:
+            if self.highs:
+                low = t - self.fall
+                if self.first_low is None:
+                    self.first_low = low
+                elif low > GAP_RATIO * self.first_low:
+                    # Gap in the middle of a frame, so give up on it
+                    self.errors.append(self.start)
+                    self.highs = []
+            if not self.highs:
+                self.start = t
+                self.first_low = None
+            self.rise = t
+            return None
+
+        if self.start is None:
+            return None  # capture started in the middle of a pulse
+        self.fall = t
+        self.highs.append(t - self.rise)
+        if len(self.highs) < FRAME_BITS:
+            return None
+
+        decoded = decode_frame(self.highs)
+        start = self.start
+        self.highs = []
+        self.start = None
+        if decoded is None:
+            self.errors.append(start)
+            return None
+        return (start,) + decoded
+
+    def timeout(self, t, limit):
+        """Abandon a frame in progress if the pin has been idle for limit seconds"""
+        if self.highs and t - self.fall > limit:
+            self.errors.append(self.start)
+            self.highs = []
+            self.start = None
+
+
+def decode_events(f, channel=1, samplerate=None, errors=None):
+    """Yield (time, event ID, value) for each frame in the capture"""
+    decoder = FrameDecoder()
+    for t, level in read_edges(f, channel, samplerate):
+        event = decoder.feed(t, level)
+        if event is not None:
+            yield event
+    if errors is not None:
+        errors.extend(decoder.errors)
+
+
+class Stats:
+    def __init__(self):
+        self.samples = []
+
+    def add(self, x):
+        self.samples.append(x)
+
+    def summary(self, scale=1.0):
+        s = sorted(self.samples)
+        n = len(s)
+        return "n=%-6d min=%-9.1f mean=%-9.1f p50=%-9.1f p99=%-9.1f max=%-9.1f" % (
+            n, s[0] * scale, sum(s) / n * scale, s[n // 2] * scale,
+            s[min(n - 1, (n * 99) // 100)] * scale, s[-1] * scale)
+
+    def histogram(self, scale=1.0, integer=False):
+        lo = min(self.samples) * scale
+        hi = max(self.samples) * scale
+        if integer:
+            counts = defaultdict(int)
+            for x in self.samples:
+                counts[int(x)] += 1
+            rows = sorted(counts.items())
+            if len(rows) > 2 * HISTOGRAM_BINS:
+                integer = False
+            else:
+                peak = max(counts.values())
+                return ["  %9d | %-*s %d" % (k, HISTOGRAM_WIDTH, "#" * max(1, c * HISTOGRAM_WIDTH // peak), c)
+                        for k, c in rows]
+        width = (hi - lo) / HISTOGRAM_BINS or 1.0
+        counts = [0] * HISTOGRAM_BINS
+        for x in self.samples:
+            counts[min(HISTOGRAM_BINS - 1, int((x * scale - lo) / width))] += 1
+        peak = max(counts)
+        return ["  %9.1f | %-*s %d" % (lo + i * width, HISTOGRAM_WIDTH, "#" * (c * HISTOGRAM_WIDTH // peak), c)
+                for i, c in enumerate(counts)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode DEBUG_PIN trace captures")
+    parser.add_argument("csv", help="logic analyzer CSV export ('-' for stdin)")
+    parser.add_argument("--channel", type=int, default=1, help="CSV column holding DEBUG_PIN")
+    parser.add_argument("--samplerate", type=float, help="sample rate, for exports without a time column")
+    parser.add_argument("--quiet", action="store_true", help="skip the timeline")
+    args = parser.parse_args()
+
+    f = sys.stdin if args.csv == "-" else open(args.csv, newline="")
+
+    begins = {}  # begin ID -> time of the open span
+    durations = defaultdict(Stats)  # span name -> durations
+    values = defaultdict(Stats)  # event ID -> values
+    errors = []
+    last_tick = None
+
+    for t, event_id, value in decode_events(f, args.channel, args.samplerate, errors):
+        values[event_id].add(value)
+
+        note = ""
+        for name, begin_id, end_id in SPANS:
+            if event_id == begin_id:
+                begins[begin_id] = t
+            elif event_id == end_id and begin_id in begins:
+                duration = t - begins.pop(begin_id)
+                durations[name].add(duration)
+                note = "  (%s took %.1f us)" % (name, duration * 1e6)
+
+        if event_id == 0:
+            last_tick = t
+
+        if not args.quiet:
+            since_tick = "" if last_tick is None else "+%9.1f us" % ((t - last_tick) * 1e6)
+            print("%12.6f s %s  %-16s %3d%s" % (t, since_tick, event_name(event_id), value, note))
+
+    print()
+    print("Durations [us]")
+    for name, _, _ in SPANS:
+        if name in durations:
+            print("%-10s %s" % (name, durations[name].summary(1e6)))
+    for name, _, _ in SPANS:
+        if name in durations:
+            print()
+            print("%s duration histogram [us]" % name)
+            print("\n".join(durations[name].histogram(1e6)))
+
+    for event_id in sorted(values):
+        print()
+        print("%s value histogram" % event_name(event_id))
+        print("\n".join(values[event_id].histogram(integer=True)))
+
+    if errors:
+        print()
+        print("%d undecodable frames, first at %.6f s" % (len(errors), errors[0]))
+
+
+if __name__ == "__main__":
+    main()